@@ -0,0 +1,291 @@
+/*
+ * Microbenchmark of wrappers.
+ * Runs every case in a tight loop and reports latency of its first
+ * call and mean latency of one call, in nanoseconds:
+ *   bench <library> [config]...
+ * Every config is run in its own process (see bench.h for configs).
+ * BENCH_CALLS sets number of calls of every case, 100000 by default.
+ *
+ * Output is tab-separated, one line per config and case:
+ *   config  case  first_ns  ns_per_call  calls
+ *
+ * Calls, which return descriptors or streams, are timed in batches,
+ * and batches are closed untimed, so cases measure single function.
+ */
+
+#include "bench.h"
+
+#define BATCH 256
+
+static char path[] = "/tmp/fu53-bench-XXXXXX";
+static int dirfd = -1;
+
+static int open_read(void)
+{
+	return open(path, O_RDONLY);
+}
+
+static int open_write(void)
+{
+	return open(path, O_WRONLY | O_CREAT, 0600);
+}
+
+static int openat_read(void)
+{
+	return openat(dirfd, strrchr(path, '/') + 1, O_RDONLY);
+}
+
+static int dup_stdin(void)
+{
+	return dup(STDIN_FILENO);
+}
+
+static FILE *fopen_read(void)
+{
+	return fopen(path, "r");
+}
+
+static FILE *fopen_write(void)
+{
+	return fopen(path, "w");
+}
+
+static int close_invalid(void)
+{
+	return close(-1);
+}
+
+static int fork_call(void)
+{
+	pid_t pid = fork();
+
+	if (!pid)
+		_exit(0);
+	if (pid > 0)
+		waitpid(pid, NULL, 0);
+	return pid;
+}
+
+static int syscall_getpid(void)
+{
+	return syscall(SYS_getpid);
+}
+
+static int setenv_call(void)
+{
+	return setenv("FU53_BENCH", "1", 1);
+}
+
+static int unlink_missing(void)
+{
+	return unlink("/tmp/fu53-bench-missing");
+}
+
+static int rename_missing(void)
+{
+	return rename("/tmp/fu53-bench-missing", "/tmp/fu53-bench-missing2");
+}
+
+static int chmod_call(void)
+{
+	return chmod(path, 0600);
+}
+
+/* Cases, which return descriptors.
+ */
+static const struct
+{
+	const char *name;
+	int (*call)(void);
+} fds[] = {
+	{"open_read", open_read},
+	{"open_write", open_write},
+	{"openat_read", openat_read},
+	{"dup", dup_stdin},
+};
+
+/* Cases, which return streams.
+ */
+static const struct
+{
+	const char *name;
+	FILE *(*call)(void);
+} streams[] = {
+	{"fopen_read", fopen_read},
+	{"fopen_write", fopen_write},
+};
+
+/* Cases, which return status only.
+ */
+static const struct
+{
+	const char *name;
+	int (*call)(void);
+	unsigned long max; /* calls, 0 means BENCH_CALLS */
+} others[] = {
+	{"close_invalid", close_invalid, 0},
+	{"fork", fork_call, 1000},
+	{"syscall", syscall_getpid, 0},
+	{"setenv", setenv_call, 0},
+	{"unlink", unlink_missing, 0},
+	{"rename", rename_missing, 0},
+	{"chmod", chmod_call, 0},
+};
+
+static void report(const char *config, const char *name, unsigned long first, unsigned long total, unsigned long calls)
+{
+	printf("%s\t%s\t%lu\t%.1f\t%lu\n", config, name, first, (double)total / calls, calls);
+	fflush(stdout);
+}
+
+static void run(const char *config, unsigned long calls)
+{
+	unsigned long first, total, start, done, n;
+	int batch[BATCH];
+	FILE *files[BATCH];
+
+	dirfd = open("/tmp", O_RDONLY | O_DIRECTORY);
+
+	for (size_t c = 0; c < sizeof(fds) / sizeof(*fds); c++)
+	{
+		start = now();
+		batch[0] = fds[c].call();
+		first = now() - start;
+		if (batch[0] >= 0)
+			close(batch[0]);
+
+		for (total = 0, done = 0; done < calls; done += n)
+		{
+			n = (calls - done < BATCH ? calls - done : BATCH);
+
+			start = now();
+			for (unsigned long i = 0; i < n; i++)
+				batch[i] = fds[c].call();
+			total += now() - start;
+
+			for (unsigned long i = 0; i < n; i++)
+				if (batch[i] >= 0)
+					close(batch[i]);
+		}
+
+		report(config, fds[c].name, first, total, calls);
+	}
+
+	for (size_t c = 0; c < sizeof(streams) / sizeof(*streams); c++)
+	{
+		start = now();
+		files[0] = streams[c].call();
+		first = now() - start;
+		if (files[0])
+			fclose(files[0]);
+
+		for (total = 0, done = 0; done < calls; done += n)
+		{
+			n = (calls - done < BATCH ? calls - done : BATCH);
+
+			start = now();
+			for (unsigned long i = 0; i < n; i++)
+				files[i] = streams[c].call();
+			total += now() - start;
+
+			for (unsigned long i = 0; i < n; i++)
+				if (files[i])
+					fclose(files[i]);
+		}
+
+		report(config, streams[c].name, first, total, calls);
+	}
+
+	for (size_t c = 0; c < sizeof(others) / sizeof(*others); c++)
+	{
+		unsigned long max = (others[c].max && others[c].max < calls ? others[c].max : calls);
+
+		start = now();
+		others[c].call();
+		first = now() - start;
+
+		start = now();
+		for (unsigned long i = 0; i < max; i++)
+			others[c].call();
+		total = now() - start;
+
+		report(config, others[c].name, first, total, max);
+	}
+}
+
+/* Runs config in new process with library preloaded.
+ */
+static int spawn(const char *self, const char *library, const char *config)
+{
+	char **env = environment(library, config, 0);
+	pid_t pid;
+	int status;
+
+	if (!env)
+		return -1;
+
+	pid = fork();
+	if (pid == -1)
+		return -1;
+
+	if (!pid)
+	{
+		execve(self, (char *[]){(char *)self, "--run", (char *)config, path, NULL}, env);
+		_exit(127);
+	}
+
+	if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status))
+	{
+		fprintf(stderr, "bench: config %s failed\n", config);
+		return -1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	const char *calls = getenv("BENCH_CALLS");
+	char library[4096];
+	int fd, ret = 0;
+
+	if (argc == 4 && !strcmp(argv[1], "--run"))
+	{
+		snprintf(path, sizeof(path), "%s", argv[3]);
+		run(argv[2], calls ? strtoul(calls, NULL, 10) : 100000);
+		return 0;
+	}
+
+	if (argc < 2)
+	{
+		fprintf(stderr, "usage: %s <library> [config]...\n", argv[0]);
+		return 1;
+	}
+
+	if (!realpath(argv[1], library))
+	{
+		perror(argv[1]);
+		return 1;
+	}
+
+	fd = mkstemp(path);
+	if (fd == -1)
+	{
+		perror("mkstemp");
+		return 1;
+	}
+	write(fd, "fu53\n", 5);
+	close(fd);
+
+	printf("config\tcase\tfirst_ns\tns_per_call\tcalls\n");
+	fflush(stdout);
+
+	if (argc == 2)
+		ret |= spawn("/proc/self/exe", library, "raw") | spawn("/proc/self/exe", library, "default");
+
+	for (int i = 2; i < argc; i++)
+		ret |= spawn("/proc/self/exe", library, argv[i]);
+
+	unlink(path);
+	return (ret ? 1 : 0);
+}
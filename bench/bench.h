@@ -0,0 +1,65 @@
+/*
+ * Helpers of benchmarks.
+ * Configs of library are written as one word: "raw" runs target
+ * without library, "default" runs it preloaded without variables,
+ * other configs are variables, separated by ',', which are set
+ * with library preloaded, e.g. WITH_OPEN=0,FU53_BUDGET=thread.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+
+static inline unsigned long now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ul + ts.tv_nsec;
+}
+
+/* Returns environment of config: environment of benchmark without
+ * variables of library, with LD_PRELOAD and variables of config.
+ * Array has room for extra variables, which caller can append.
+ */
+static inline char **environment(const char *library, const char *config, size_t extra)
+{
+	extern char **environ;
+	char *vars, *var, **env;
+	size_t count = 0, n = 0;
+
+	while (environ[count])
+		count++;
+
+	vars = strdup(config);
+	env = calloc(count + strlen(config) + extra + 2, sizeof(*env));
+	if (!vars || !env)
+		return NULL;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		if (!strncmp(environ[i], "WITH_", 5) || !strncmp(environ[i], "NO_", 3) || !strncmp(environ[i], "FU53_", 5) ||
+			!strncmp(environ[i], "LD_PRELOAD=", 11))
+			continue;
+		env[n++] = environ[i];
+	}
+
+	if (!strcmp(config, "raw"))
+		return env;
+
+	if (asprintf(&env[n++], "LD_PRELOAD=%s", library) == -1)
+		return NULL;
+
+	if (strcmp(config, "default"))
+		for (var = strtok(vars, ","); var; var = strtok(NULL, ","))
+			env[n++] = var;
+
+	return env;
+}
@@ -0,0 +1,227 @@
+/*
+ * Execution benchmark.
+ * Runs sample targets (see target.c) like fuzzer does and reports
+ * executions per second:
+ *   exec <library> <target> [config]...
+ * Every target runs in three modes:
+ * - exec, fork and execve() of target for every execution, so it pays
+ *   for loading and constructor of library every time;
+ * - forkserver, target is started once and forks children on request
+ *   over pipes on descriptors 198 and 199;
+ * - persistent, target runs all executions in one process, which
+ *   is started once.
+ * Configs are "raw" and "default" by default (see bench.h for configs).
+ * BENCH_EXECS sets number of executions of every mode, 2000 by default.
+ *
+ * Output is tab-separated, one line per config, mode and target:
+ *   config  mode  target  execs  execs_per_sec  us_per_exec  overhead_us
+ * Overhead is difference of us_per_exec with raw config, which is run
+ * before, or "-". Overhead of noop target in exec mode is startup
+ * cost of library: loading and constructor.
+ */
+
+#include "bench.h"
+
+#define FORKSRV_FD 198
+#define INPUT_SIZE 4096
+
+enum mode
+{
+	EXEC,
+	FORKSERVER,
+	PERSISTENT,
+	MODES
+};
+
+static const char *const modes[MODES] = {"exec", "forkserver", "persistent"};
+static const char *const targets[] = {"noop", "write", "fork", "parse"};
+
+#define TARGETS (sizeof(targets) / sizeof(*targets))
+
+static char input[] = "/tmp/fu53-input-XXXXXX";
+static const char *target;
+
+/* Microseconds per execution of raw config.
+ */
+static double raw[MODES][TARGETS];
+
+static pid_t start(char **env, const char *name, int ctl, int st)
+{
+	pid_t pid = fork();
+
+	if (pid)
+		return pid;
+
+	if (ctl != -1)
+	{
+		dup2(ctl, FORKSRV_FD);
+		dup2(st, FORKSRV_FD + 1);
+	}
+
+	execve(target, (char *[]){(char *)target, (char *)name, input, NULL}, env);
+	_exit(127);
+}
+
+static int finish(pid_t pid)
+{
+	int status;
+
+	if (pid == -1 || waitpid(pid, &status, 0) == -1)
+		return -1;
+
+	return (WIFEXITED(status) && !WEXITSTATUS(status) ? 0 : -1);
+}
+
+static int run_exec(char **env, const char *name, unsigned long execs)
+{
+	for (unsigned long i = 0; i < execs; i++)
+		if (finish(start(env, name, -1, -1)) == -1)
+			return -1;
+
+	return 0;
+}
+
+static int run_forkserver(char **env, const char *name, unsigned long execs)
+{
+	int ctl[2], st[2], value;
+	pid_t pid;
+
+	if (pipe2(ctl, O_CLOEXEC) == -1 || pipe2(st, O_CLOEXEC) == -1)
+		return -1;
+
+	pid = start(env, name, ctl[0], st[1]);
+	close(ctl[0]);
+	close(st[1]);
+
+	if (read(st[0], &value, 4) != 4)
+		goto out;
+
+	for (unsigned long i = 0; i < execs; i++)
+	{
+		if (write(ctl[1], &value, 4) != 4 || read(st[0], &value, 4) != 4 || read(st[0], &value, 4) != 4)
+			goto out;
+
+		if (!WIFEXITED(value) || WEXITSTATUS(value))
+			goto out;
+	}
+
+	close(ctl[1]);
+	close(st[0]);
+	return finish(pid);
+
+out:
+	close(ctl[1]);
+	close(st[0]);
+	finish(pid);
+	return -1;
+}
+
+static int run_persistent(char **env, const char *name, unsigned long execs)
+{
+	char iterations[64];
+	size_t n = 0;
+	int ret;
+
+	while (env[n])
+		n++;
+
+	snprintf(iterations, sizeof(iterations), "BENCH_PERSISTENT=%lu", execs);
+	env[n] = iterations;
+	ret = finish(start(env, name, -1, -1));
+	env[n] = NULL;
+
+	return ret;
+}
+
+static int run(const char *library, const char *config, unsigned long execs)
+{
+	char **env = environment(library, config, 1);
+	unsigned long begin, ns;
+	double us;
+	size_t n = 0;
+	int ret = 0;
+
+	if (!env)
+		return -1;
+
+	while (env[n])
+		n++;
+
+	for (int mode = 0; mode < MODES; mode++)
+	{
+		env[n] = (mode == FORKSERVER ? "BENCH_FORKSERVER=1" : NULL);
+
+		for (size_t t = 0; t < TARGETS; t++)
+		{
+			begin = now();
+			if ((mode == EXEC ? run_exec : mode == FORKSERVER ? run_forkserver : run_persistent)(env, targets[t], execs))
+			{
+				fprintf(stderr, "exec: %s %s %s failed\n", config, modes[mode], targets[t]);
+				ret = -1;
+				continue;
+			}
+			ns = now() - begin;
+			us = ns / 1000.0 / execs;
+
+			if (!strcmp(config, "raw"))
+				raw[mode][t] = us;
+
+			printf("%s\t%s\t%s\t%lu\t%.0f\t%.2f\t", config, modes[mode], targets[t], execs, execs * 1e9 / ns, us);
+			if (raw[mode][t])
+				printf("%.2f\n", us - raw[mode][t]);
+			else
+				printf("-\n");
+			fflush(stdout);
+		}
+	}
+
+	env[n] = NULL;
+	free(env);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	const char *execs = getenv("BENCH_EXECS");
+	char library[4096], buf[INPUT_SIZE];
+	unsigned long count = (execs ? strtoul(execs, NULL, 10) : 2000);
+	int fd, ret = 0;
+
+	if (argc < 3)
+	{
+		fprintf(stderr, "usage: %s <library> <target> [config]...\n", argv[0]);
+		return 1;
+	}
+
+	if (!realpath(argv[1], library))
+	{
+		perror(argv[1]);
+		return 1;
+	}
+	target = argv[2];
+
+	fd = mkstemp(input);
+	if (fd == -1)
+	{
+		perror("mkstemp");
+		return 1;
+	}
+
+	for (size_t i = 0; i < sizeof(buf); i++)
+		buf[i] = 'a' + i % 26;
+	if (write(fd, buf, sizeof(buf)) != sizeof(buf))
+		perror("write");
+	close(fd);
+
+	printf("config\tmode\ttarget\texecs\texecs_per_sec\tus_per_exec\toverhead_us\n");
+	fflush(stdout);
+
+	if (argc == 3)
+		ret |= run(library, "raw", count) | run(library, "default", count);
+
+	for (int i = 3; i < argc; i++)
+		ret |= run(library, argv[i], count);
+
+	unlink(input);
+	return (ret ? 1 : 0);
+}
@@ -0,0 +1,190 @@
+/*
+ * Sample targets of execution benchmark.
+ *   target <noop|write|fork|parse> <input>
+ * - noop does nothing, so its executions measure startup;
+ * - write copies input into output files and removes them;
+ * - fork forks children, which exit at once;
+ * - parse reads input with small reads and opens few system files.
+ *
+ * With BENCH_FORKSERVER=1 target runs AFL-style forkserver on
+ * descriptors 198 and 199 before target code: every command forks child,
+ * which runs target once. With BENCH_PERSISTENT=N target runs N times in
+ * one process, marking iterations for library, when it's preloaded.
+ */
+
+#include "bench.h"
+
+#define FORKSRV_FD 198
+#define OUTPUTS 16
+#define FORKS 4
+
+void fu53_iteration_begin(void) __attribute__((weak));
+void fu53_iteration_end(void) __attribute__((weak));
+
+static void noop(const char *input)
+{
+	(void)input;
+}
+
+static void write_files(const char *input)
+{
+	char buf[4096], path[64];
+	ssize_t len;
+	int fd, out;
+
+	fd = open(input, O_RDONLY);
+	if (fd == -1)
+		return;
+	len = read(fd, buf, sizeof(buf));
+	close(fd);
+
+	for (int i = 0; i < OUTPUTS; i++)
+	{
+		snprintf(path, sizeof(path), "/tmp/fu53-target-%d-%d", getpid(), i);
+		out = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+		if (out == -1)
+			continue;
+		if (len > 0 && write(out, buf, len) != len)
+			perror("write");
+		close(out);
+		unlink(path);
+	}
+}
+
+static void fork_children(const char *input)
+{
+	pid_t pid;
+
+	(void)input;
+
+	for (int i = 0; i < FORKS; i++)
+	{
+		pid = fork();
+		if (!pid)
+			_exit(0);
+		if (pid > 0)
+			waitpid(pid, NULL, 0);
+	}
+}
+
+static void parse(const char *input)
+{
+	static const char *const files[] = {"/etc/hostname", "/etc/passwd", "/etc/nsswitch.conf"};
+	unsigned long sum = 0;
+	unsigned char buf[64];
+	struct stat st;
+	ssize_t len;
+	int fd;
+
+	fd = open(input, O_RDONLY);
+	if (fd == -1)
+		return;
+
+	fstat(fd, &st);
+	while ((len = read(fd, buf, sizeof(buf))) > 0)
+	{
+		for (ssize_t i = 0; i < len; i++)
+			sum += buf[i];
+		lseek(fd, 0, SEEK_CUR);
+	}
+	close(fd);
+
+	for (size_t i = 0; i < sizeof(files) / sizeof(*files); i++)
+	{
+		fd = open(files[i], O_RDONLY);
+		if (fd == -1)
+			continue;
+		while (read(fd, buf, sizeof(buf)) > 0)
+			;
+		close(fd);
+	}
+
+	if (sum == 1)
+		puts("");
+}
+
+/* Forks children with _Fork(), which isn't interposed, like forkserver
+ * of instrumented binary, which shouldn't be blocked by WITH_FORK.
+ * Child starts new execution context, like atfork handler of library.
+ * Returns in child.
+ */
+static void forkserver(void)
+{
+	int status = 0;
+	pid_t pid;
+
+	if (write(FORKSRV_FD + 1, &status, 4) != 4)
+		return;
+
+	while (read(FORKSRV_FD, &status, 4) == 4)
+	{
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 34)
+		pid = _Fork();
+#else
+		pid = syscall(SYS_fork);
+#endif
+		if (!pid)
+		{
+			close(FORKSRV_FD);
+			close(FORKSRV_FD + 1);
+			if (fu53_iteration_begin)
+				fu53_iteration_begin();
+			return;
+		}
+
+		if (write(FORKSRV_FD + 1, &pid, 4) != 4 || waitpid(pid, &status, 0) == -1 ||
+			write(FORKSRV_FD + 1, &status, 4) != 4)
+			_exit(1);
+	}
+
+	_exit(0);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct
+	{
+		const char *name;
+		void (*run)(const char *input);
+	} targets[] = {
+		{"noop", noop},
+		{"write", write_files},
+		{"fork", fork_children},
+		{"parse", parse},
+	};
+	void (*run)(const char *input) = NULL;
+	const char *persistent = getenv("BENCH_PERSISTENT");
+	unsigned long iterations = 1;
+
+	if (argc != 3)
+	{
+		fprintf(stderr, "usage: %s <noop|write|fork|parse> <input>\n", argv[0]);
+		return 1;
+	}
+
+	for (size_t i = 0; i < sizeof(targets) / sizeof(*targets); i++)
+		if (!strcmp(argv[1], targets[i].name))
+			run = targets[i].run;
+
+	if (!run)
+		return 1;
+
+	if (getenv("BENCH_FORKSERVER"))
+		forkserver();
+
+	if (persistent)
+		iterations = strtoul(persistent, NULL, 10);
+
+	for (unsigned long i = 0; i < iterations; i++)
+	{
+		if (persistent && fu53_iteration_begin)
+			fu53_iteration_begin();
+
+		run(argv[2]);
+
+		if (persistent && fu53_iteration_end)
+			fu53_iteration_end();
+	}
+
+	return 0;
+}
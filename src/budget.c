@@ -0,0 +1,80 @@
+/*
+ * Budgets of WITH_OPEN=N, WITH_FORK=N and WITH_PARALLEL=N.
+ * Every category has global pool of calls. Threads take calls from
+ * pool by slabs, which are kept in thread local storage, so most of
+ * budgeted calls don't touch shared cache line at all. Slabs become
+ * smaller, when pool is close to exhaustion, so almost whole budget
+ * can be spent by any thread.
+ *
+ * With FU53_BUDGET=thread every thread gets its own budget of N calls
+ * and pools aren't used at all.
+ *
+ * Pools are refilled on every reset of execution context, and slabs
+ * of older generation are dropped by their threads.
+ */
+
+#include "fu53.h"
+
+/* Maximal size of slab, and part of pool, which is taken at once.
+ */
+#define SLAB_MAX 64
+#define SLAB_SHIFT 3
+
+__thread unsigned int fu53_slabs[FU53_CATEGORIES] __attribute__((tls_model("initial-exec")));
+
+__thread unsigned long fu53_slabs_generation __attribute__((tls_model("initial-exec")));
+
+static __thread char granted[FU53_CATEGORIES] __attribute__((tls_model("initial-exec")));
+
+static struct
+{
+	long left;
+} __attribute__((aligned(64))) pools[FU53_CATEGORIES];
+
+void fu53_budget_init(unsigned int mask)
+{
+	for (int i = 0; i < FU53_CATEGORIES; i++)
+		if (mask & (1u << i))
+			__atomic_store_n(&pools[i].left, fu53_limits[i], __ATOMIC_RELAXED);
+}
+
+int fu53_refill(enum fu53_category category)
+{
+	unsigned long generation = __atomic_load_n(&fu53_generation, __ATOMIC_ACQUIRE);
+	long left, take;
+
+	/* slabs of previous execution are dropped */
+	if (fu53_slabs_generation != generation)
+	{
+		memset(fu53_slabs, 0, sizeof(fu53_slabs));
+		memset(granted, 0, sizeof(granted));
+		fu53_slabs_generation = generation;
+	}
+
+	if (fu53_policy.quota)
+	{
+		if (granted[category])
+			return 0;
+
+		granted[category] = 1;
+		fu53_slabs[category] = fu53_limits[category] - 1;
+		return 1;
+	}
+
+	left = __atomic_load_n(&pools[category].left, __ATOMIC_RELAXED);
+	do
+	{
+		if (left <= 0)
+			return 0;
+
+		take = left >> SLAB_SHIFT;
+		if (take > SLAB_MAX)
+			take = SLAB_MAX;
+		else if (take < 1)
+			take = 1;
+	} while (!__atomic_compare_exchange_n(&pools[category].left, &left, left - take, 1,
+										  __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+	fu53_slabs[category] = take - 1;
+	return 1;
+}
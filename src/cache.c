@@ -0,0 +1,182 @@
+/*
+ * Content cache.
+ * FU53_CACHE=<patterns> loads files, matching glob(3) patterns separated
+ * by ':', e.g. FU53_CACHE=/etc/ld.so.cache:/usr/share/dict/words, into
+ * sealed memfds, when library is loaded. So it's done once by forkserver
+ * parent, and read-mode opens of these files in every child get new
+ * file description of cached copy, which skips path walk of file system
+ * and reading from page cache of real file.
+ *
+ * Files are expected not to change while target runs. Table of cached
+ * files is filled by constructor and is read-only later, so lookups
+ * don't lock. Target can close copy, and number can be reused by other
+ * file, so reopened copy is checked by device and inode of memfd, and
+ * lost copy is dropped from table.
+ */
+
+#include "fu53.h"
+#include <glob.h>
+
+#define FILES 1024
+#define FILE_MAX (64 << 20)
+
+/* Cached copies are moved to high descriptors like sink.
+ */
+#define CACHE_FD 1000
+
+static struct
+{
+	struct fu53_key key;
+	int fd;
+	dev_t dev;
+	ino_t ino;
+} files[FILES];
+
+static unsigned int count;
+
+/* Copies file into sealed memfd, and fills device and inode of it.
+ */
+static int load(const char *pathname, struct stat *copy)
+{
+	int real, fd, high;
+	struct stat st;
+	off_t offset = 0;
+	ssize_t ret = 0;
+
+	real = ORIGINAL(openat)(AT_FDCWD, pathname, O_RDONLY | O_CLOEXEC);
+	if (real == -1)
+		return -1;
+
+	fd = -1;
+	if (fstat(real, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size > FILE_MAX)
+		goto out;
+
+	fd = memfd_create("fu53-cache", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd == -1)
+		goto out;
+
+	while (offset < st.st_size && (ret = ORIGINAL(sendfile)(fd, real, &offset, st.st_size - offset)) > 0)
+		;
+
+	if (ret == -1 || fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == -1 ||
+		fstat(fd, copy) == -1)
+	{
+		ORIGINAL(close)(fd);
+		fd = -1;
+		goto out;
+	}
+
+	high = fcntl(fd, F_DUPFD_CLOEXEC, CACHE_FD);
+	if (high != -1)
+	{
+		ORIGINAL(close)(fd);
+		fd = high;
+	}
+
+out:
+	ORIGINAL(close)(real);
+	return fd;
+}
+
+static void add(const char *pathname)
+{
+	char buf[PATH_MAX];
+	const char *canonical = fu53_canon(AT_FDCWD, pathname, buf);
+	unsigned long h;
+	struct stat st;
+	int i, fd;
+
+	if (!canonical)
+		return;
+
+	h = fu53_hash(canonical);
+	i = fu53_slot(files, sizeof(*files), FILES, canonical, h);
+	if (i == -1 || files[i].key.path)
+		return;
+
+	fd = load(pathname, &st);
+	if (fd == -1)
+		return;
+
+	files[i].key.path = strdup(canonical);
+	if (!files[i].key.path)
+	{
+		ORIGINAL(close)(fd);
+		return;
+	}
+
+	files[i].key.hash = h;
+	files[i].fd = fd;
+	files[i].dev = st.st_dev;
+	files[i].ino = st.st_ino;
+	count++;
+}
+
+void fu53_cache_init(const char *patterns)
+{
+	char pattern[PATH_MAX];
+	glob_t found;
+	size_t len;
+
+	while (*patterns)
+	{
+		len = strcspn(patterns, ":");
+		if (len && len < sizeof(pattern))
+		{
+			memcpy(pattern, patterns, len);
+			pattern[len] = '\0';
+
+			if (!glob(pattern, GLOB_NOSORT, NULL, &found))
+			{
+				for (size_t i = 0; i < found.gl_pathc; i++)
+					add(found.gl_pathv[i]);
+				globfree(&found);
+			}
+		}
+
+		patterns += len;
+		if (*patterns)
+			patterns++;
+	}
+
+	if (count)
+		fu53_policy.cache = 1;
+}
+
+int fu53_cache_open(int dirfd, const char *pathname, int flags)
+{
+	char buf[PATH_MAX], path[32];
+	const char *canonical;
+	struct stat st;
+	int i, fd, copy;
+
+	if ((flags & O_ACCMODE) != O_RDONLY || flags & (O_TRUNC | O_DIRECTORY | O_PATH))
+		return FU53_SHADOW_NONE;
+
+	canonical = fu53_canon(dirfd, pathname, buf);
+	if (!canonical)
+		return FU53_SHADOW_NONE;
+
+	i = fu53_slot(files, sizeof(*files), FILES, canonical, fu53_hash(canonical));
+	if (i == -1 || !files[i].key.path)
+		return FU53_SHADOW_NONE;
+
+	copy = __atomic_load_n(&files[i].fd, __ATOMIC_RELAXED);
+	if (copy == -1)
+		return FU53_SHADOW_NONE;
+
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", copy);
+	fd = ORIGINAL(openat)(AT_FDCWD, path, flags & (O_CLOEXEC | O_NONBLOCK));
+	if (fd == -1)
+		return FU53_SHADOW_NONE;
+
+	/* copy could be closed by target, and number reused by other file */
+	if (fstat(fd, &st) == -1 || st.st_dev != files[i].dev || st.st_ino != files[i].ino)
+	{
+		ORIGINAL(close)(fd);
+		__atomic_store_n(&files[i].fd, -1, __ATOMIC_RELAXED);
+		return FU53_SHADOW_NONE;
+	}
+
+	return fd;
+}
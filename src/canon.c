@@ -0,0 +1,248 @@
+/*
+ * Canonical paths.
+ * Path-based policy (rules, shadows) sees absolute, lexically normal
+ * paths: relative paths are joined with current directory or with
+ * directory of dirfd, and empty, "." and ".." components are resolved.
+ * Symlinks aren't followed.
+ *
+ * Current directory is read once by constructor and after every
+ * chdir()/fchdir(). Paths of dirfds are read from /proc/self/fd on
+ * first use and cached with device and inode of directory. Libc can
+ * close and reuse descriptor number without wrappers, so every use of
+ * cached path is checked by fstat(), which is much cheaper than
+ * readlink() of /proc. Slots are also dropped by close(), closedir(),
+ * dup2() and dup3().
+ *
+ * Readers never lock: cwd and every cache slot are guarded by sequence
+ * counters, and readers copy path and retry, when it was changed.
+ */
+
+#include "fu53.h"
+
+#define DIRS 64
+
+struct entry
+{
+	unsigned int seq;
+	int fd;
+	dev_t dev;
+	ino_t ino;
+	char path[PATH_MAX];
+};
+
+static struct entry cwd = {.fd = AT_FDCWD};
+static struct entry dirs[DIRS] = {[0 ... DIRS - 1] = {.fd = -1}};
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Copies path of entry into buf.
+ * Returns length of path, or -1, when entry doesn't hold fd
+ * or holds other file, than st.
+ */
+static int load(struct entry *entry, int fd, const struct stat *st, char *buf)
+{
+	unsigned int seq;
+	int len;
+
+	do
+	{
+		seq = __atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+
+		if (__atomic_load_n(&entry->fd, __ATOMIC_RELAXED) != fd)
+			return -1;
+
+		if (st && (entry->dev != st->st_dev || entry->ino != st->st_ino))
+			return -1;
+
+		len = strnlen(entry->path, PATH_MAX - 1);
+		memcpy(buf, entry->path, len);
+		buf[len] = '\0';
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((seq & 1) || __atomic_load_n(&entry->seq, __ATOMIC_RELAXED) != seq);
+
+	return len;
+}
+
+static void store(struct entry *entry, int fd, const struct stat *st, const char *path)
+{
+	pthread_mutex_lock(&lock);
+	__atomic_add_fetch(&entry->seq, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	__atomic_store_n(&entry->fd, fd, __ATOMIC_RELAXED);
+	if (st)
+		entry->dev = st->st_dev, entry->ino = st->st_ino;
+	if (path)
+		strncpy(entry->path, path, PATH_MAX - 1);
+
+	__atomic_add_fetch(&entry->seq, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&lock);
+}
+
+/* Reads current directory.
+ */
+void fu53_canon_chdir(void)
+{
+	char path[PATH_MAX];
+
+	if (getcwd(path, sizeof(path)))
+		store(&cwd, AT_FDCWD, NULL, path);
+	else
+		store(&cwd, -1, NULL, NULL);
+}
+
+void fu53_canon_forget(int fd)
+{
+	struct entry *entry = &dirs[(unsigned int)fd % DIRS];
+
+	if (fd >= 0 && __atomic_load_n(&entry->fd, __ATOMIC_RELAXED) == fd)
+		store(entry, -1, NULL, NULL);
+}
+
+/* Copies path of directory, which dirfd refers to, into buf.
+ * Returns length of path, or -1, when path is unknown.
+ */
+static int directory(int dirfd, char *buf)
+{
+	struct entry *entry;
+	struct stat st;
+	char link[32];
+	long len;
+
+	if (dirfd == AT_FDCWD)
+		return load(&cwd, AT_FDCWD, NULL, buf);
+
+	if (dirfd < 0 || fstat(dirfd, &st) == -1)
+		return -1;
+
+	entry = &dirs[(unsigned int)dirfd % DIRS];
+	len = load(entry, dirfd, &st, buf);
+	if (len != -1)
+		return len;
+
+	snprintf(link, sizeof(link), "/proc/self/fd/%d", dirfd);
+	len = fu53_raw_syscall(SYS_readlinkat, AT_FDCWD, (long)link, (long)buf, PATH_MAX - 1, 0, 0);
+	if (len <= 0 || *buf != '/')
+		return -1;
+
+	buf[len] = '\0';
+	store(entry, dirfd, &st, buf);
+	return len;
+}
+
+/* Checks, that absolute path has no empty, "." and ".." components.
+ */
+static int normal(const char *pathname)
+{
+	for (const char *c = pathname; *c; c++)
+	{
+		if (*c != '/')
+			continue;
+
+		if (c[1] == '/' || (!c[1] && c != pathname))
+			return 0;
+		if (c[1] == '.' && (!c[2] || c[2] == '/'))
+			return 0;
+		if (c[1] == '.' && c[2] == '.' && (!c[3] || c[3] == '/'))
+			return 0;
+	}
+
+	return 1;
+}
+
+/* Resolves empty, "." and ".." components of absolute path in place.
+ */
+static void normalize(char *path)
+{
+	char *out = path, *in = path;
+	size_t len;
+
+	while (*in)
+	{
+		while (*in == '/')
+			in++;
+
+		len = strcspn(in, "/");
+		if (!len || (len == 1 && in[0] == '.'))
+		{
+			in += len;
+			continue;
+		}
+
+		if (len == 2 && in[0] == '.' && in[1] == '.')
+		{
+			while (out > path && *--out != '/')
+				;
+			in += len;
+			continue;
+		}
+
+		*out++ = '/';
+		memmove(out, in, len);
+		out += len;
+		in += len;
+	}
+
+	if (out == path)
+		*out++ = '/';
+	*out = '\0';
+}
+
+const char *fu53_canon(int dirfd, const char *pathname, char *buf)
+{
+	size_t len, base;
+	int ret;
+
+	if (*pathname == '/')
+	{
+		if (normal(pathname))
+			return pathname;
+
+		len = strlen(pathname);
+		if (len >= PATH_MAX)
+			return NULL;
+
+		memcpy(buf, pathname, len + 1);
+		normalize(buf);
+		return buf;
+	}
+
+	ret = directory(dirfd, buf);
+	if (ret == -1)
+		return NULL;
+
+	base = ret;
+	len = strlen(pathname);
+	if (base + 1 + len >= PATH_MAX)
+		return NULL;
+
+	buf[base] = '/';
+	memcpy(buf + base + 1, pathname, len + 1);
+	normalize(buf);
+	return buf;
+}
+
+/* Entry, which was being written by other thread at fork,
+ * is dropped.
+ */
+static void unlock(struct entry *entry)
+{
+	if (entry->seq & 1)
+	{
+		entry->fd = -1;
+		entry->seq++;
+	}
+}
+
+void fu53_canon_reset(int child)
+{
+	if (!child)
+		return;
+
+	pthread_mutex_init(&lock, NULL);
+	unlock(&cwd);
+	for (int i = 0; i < DIRS; i++)
+		unlock(&dirs[i]);
+}
@@ -0,0 +1,96 @@
+/*
+ * Classes of descriptors.
+ * Descriptors, which library gives to target instead of files, are
+ * kept in map with two bits per descriptor: real, sink, shadow or
+ * virtual. Map is updated by wrappers of open functions, close() and
+ * dup*(), so wrappers of write functions check descriptor with one
+ * load, and writes to sink are discarded without system call.
+ *
+ * Descriptors of permitted write-mode opens are marked in second map
+ * with one bit per descriptor, when FU53_WRITE_BYTES is set, so writes
+ * to them are counted against budget (see writes.c).
+ *
+ * Descriptors, given to streams, are forgotten, because streams are
+ * closed inside libc, and their numbers can be reused by descriptors,
+ * which library never sees.
+ */
+
+#include "fu53.h"
+
+unsigned long fu53_fds[FU53_FDS / FU53_FDS_PER_WORD];
+unsigned long fu53_metered[FU53_FDS / FU53_BITS_PER_WORD];
+
+void fu53_fd_set(int fd, enum fu53_fd class)
+{
+	unsigned long *word;
+	unsigned int shift;
+
+	if (fd < 0 || fd >= FU53_FDS)
+		return;
+
+	word = &fu53_fds[fd / FU53_FDS_PER_WORD];
+	shift = fd % FU53_FDS_PER_WORD * 2;
+
+	__atomic_and_fetch(word, ~(3ul << shift), __ATOMIC_RELAXED);
+	if (class != FU53_FD_REAL)
+		__atomic_or_fetch(word, (unsigned long)class << shift, __ATOMIC_RELAXED);
+}
+
+void fu53_fd_meter(int fd)
+{
+	if (fd < 0 || fd >= FU53_FDS)
+		return;
+
+	__atomic_or_fetch(&fu53_metered[fd / FU53_BITS_PER_WORD], 1ul << (fd % FU53_BITS_PER_WORD), __ATOMIC_RELAXED);
+}
+
+void fu53_fd_forget(int fd)
+{
+	enum fu53_fd class = fu53_fd_class(fd);
+
+	fu53_sink_close(fd);
+	if (fu53_fd_metered(fd))
+		__atomic_and_fetch(&fu53_metered[fd / FU53_BITS_PER_WORD], ~(1ul << (fd % FU53_BITS_PER_WORD)), __ATOMIC_RELAXED);
+	if (class == FU53_FD_REAL)
+		return;
+
+	fu53_fd_set(fd, FU53_FD_REAL);
+	if (class == FU53_FD_SINK)
+		fu53_sink_release();
+}
+
+void fu53_fd_forget_range(unsigned int first, unsigned int last)
+{
+	unsigned int end = (last < FU53_FDS - 1 ? last : FU53_FDS - 1);
+
+	fu53_sink_close_range(first, last);
+
+	for (unsigned int fd = first; fd <= end; fd++)
+		if (fu53_fd_class(fd) != FU53_FD_REAL || fu53_fd_metered(fd))
+			fu53_fd_forget(fd);
+}
+
+void fu53_fd_dup(int oldfd, int newfd)
+{
+	enum fu53_fd class = fu53_fd_class(oldfd);
+
+	if (oldfd == newfd)
+		return;
+
+	/* sink could be closed behind library, and number reused */
+	if (class == FU53_FD_SINK && !fu53_sink_is(oldfd))
+	{
+		fu53_fd_forget(oldfd);
+		class = FU53_FD_REAL;
+	}
+
+	fu53_fd_forget(newfd);
+	if (fu53_fd_metered(oldfd))
+		fu53_fd_meter(newfd);
+	if (class == FU53_FD_REAL)
+		return;
+
+	fu53_fd_set(newfd, class);
+	if (class == FU53_FD_SINK)
+		fu53_sink_hold();
+}
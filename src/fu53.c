@@ -33,779 +33,823 @@
  *   or 0 pass as N value, original functions will use;
  * - WITH_DUP, which enables original dup(), dup2(), dup3(), funcs.
  * - WITH_ENV, which enables original setenv(), unsetenv() funcs;
- * - WITH_COVERAGE, which enables coverage collection support.
+ * - WITH_COVERAGE, which enables coverage collection support. Files
+ *   with .gcda, .gcno, .profraw, .profdata suffixes are opened for
+ *   writing with original functions. Other suffixes can be passed as
+ *   value, separated by ':' or ',', e.g. WITH_COVERAGE=.gcda:.cov;
  * - WITH_UNSHARE, which enables original unshare() function.
  * - WITH_MOUNT, which enables original mount() function.
+ *
+ * N values are budgets of whole category, e.g. WITH_OPEN=2 allows
+ * one original open() and one original fopen(). They are shared by
+ * all threads of process.
  *  
  * - NO_OPEN, which throw assert(0), on original open(), open64(),
  *   openat(), creat(), fopen(), fopen64(), fdopen(), freopen() funcs;
  * - NO_EXEC, which throw assert(0) on original execv(), execve(), 
  *   execvp(), execvpe(), execveat(), fexecve(), execl(), execlp(),
  *   execle() funcs;
+ *
+ * - FU53_BUDGET=thread, which gives every thread its own budget
+ *   of N calls;
+ * - FU53_SHADOW=1, which opens memfd copies of files instead of
+ *   /dev/null on write-mode opens. Later opens of the same path see
+ *   the copy until end of execution;
+ * - FU53_SINK_MAX=N, which limits number of /dev/null descriptors,
+ *   held by target, 512 by default. Redirected opens fail with EMFILE
+ *   over the limit;
+ * - FU53_SECCOMP=1, which enforces policy with seccomp filter too,
+ *   so raw system calls are blocked as well (see seccomp.c);
+ * - FU53_LANDLOCK=<dir>, which lets kernel check paths with Landlock:
+ *   files can be written, removed and renamed only under <dir>
+ *   (see landlock.c);
+ * - FU53_RULES=<file>, which loads rules, that allow or deny opens,
+ *   removes, renames and changes of files by path globs, e.g.
+ *   "allow write /tmp/fuzz-**" (see rules.c);
+ * - FU53_CACHE=<patterns>, which loads files, matching glob patterns
+ *   separated by ':', into memory once, and serves read-mode opens
+ *   of them from there (see cache.c);
+ * - FU53_INPUT=<path>, which makes read-mode opens of virtual <path>
+ *   read testcase from AFL++ shared memory; FU53_INPUT=- places it
+ *   on stdin (see input.c);
+ * - FU53_STATS=<name>, which maps counters of calls of every function
+ *   at /dev/shm/<name> (see stats.c);
+ * - FU53_WRITE_BYTES=N[kMG] and FU53_WRITE_FILES=N, which limit bytes,
+ *   written to files of permitted write-mode opens, and number of such
+ *   opens during one execution. FU53_WRITE_ACTION=enospc|sink|crash
+ *   sets what calls over budget do (see writes.c);
  */
 
 #include "fu53.h"
 
-int open(const char *pathname, int flags, ...)
+/* Returns non-zero, when original functions of category are enabled.
+ * Throws assert(0), when NO_* variable of category is set.
+ */
+static inline int allowed(enum fu53_function id, enum fu53_category category)
 {
-	static open_type original_open = NULL;
-	static int promoted = (sizeof(mode_t) < sizeof(uint32_t) - 1 ? 1 : 0);
-	static long unsigned num = 0;
-	static char init = 0;
-	static int calls = 0;
-	char *value = NULL;
-	if (!init)
-	{
-		value = getenv("WITH_OPEN");
-		if (value)
-		{
-			num = strtoul(value, NULL, 10);
-			init = 1;
-		}
-
-		value = getenv("NO_OPEN");
-		if (value)
-			init = 2;
-		else 
-			init = 3;
-	}
-
-	if (init == 2)
-		assert(0);
-
-	if (!original_open)
-		original_open = (open_type)dlsym(RTLD_NEXT, "open");
+	unsigned char action = fu53_action(category);
 
-	if (init == 1)
+	if (action == FU53_CRASH)
 	{
-		if (calls < num || num == 0)
-		{
-			if (flags & O_CREAT)
-			{
-				va_list arg;
-				mode_t mode;
-				va_start(arg, flags);
-				if (promoted)
-					mode = va_arg(arg, uint32_t);
-				else
-					mode = va_arg(arg, mode_t);
-				va_end(arg);
-				calls++;
-				return (original_open(pathname, flags, mode));
-			}
-			calls++;
-			return (original_open(pathname, flags));
-		}
+		fu53_count(id, FU53_CRASHED);
+		assert(0);
 	}
 
-	if (getenv("WITH_COVERAGE"))
-		if (strstr(pathname, ".gcda") || strstr(pathname, ".gcno") ||
-			strstr(pathname, ".profraw") || strstr(pathname, ".profdata"))
-			return (original_open(pathname, flags));
-
-	if (flags & (O_CREAT | O_APPEND | O_WRONLY | O_RDWR | O_SYNC))
-		return (original_open("/dev/null", flags));
-
-	return (original_open(pathname, flags));
+	return (action == FU53_ALLOW);
 }
 
-int open64(const char *pathname, int flags, ...)
+/* Checks category of function, which has no other way
+ * than original function, and counts outcome.
+ */
+static inline int enabled(enum fu53_function id, enum fu53_category category)
 {
-	static open64_type original_open64 = NULL;
-	static int promoted = (sizeof(mode_t) < sizeof(uint32_t) - 1 ? 1 : 0);
-	static long unsigned num = 0;
-	static char init = 0;
-	static int calls = 0;
-	char *value = NULL;
-	if (!init)
-	{
-		value = getenv("WITH_OPEN");
-		if (value)
-		{
-			num = strtoul(value, NULL, 10);
-			init = 1;
-		}
-
-		value = getenv("NO_OPEN");
-		if (value)
-			init = 2;
-		else 
-			init = 3;
-	}
+	int ret = allowed(id, category);
 
-	if (init == 2)
-		assert(0);
+	fu53_count(id, ret ? FU53_ALLOWED : FU53_BLOCKED);
+	return ret;
+}
 
-	if (!original_open64)
-		original_open64 = (open64_type)dlsym(RTLD_NEXT, "open64");
+/* Returns non-zero, when one more original function
+ * of category can be called during this execution.
+ * Call, which can be made, is counted as allowed.
+ */
+static inline int budget(enum fu53_function id, enum fu53_category category)
+{
+	if (!fu53_limit(category))
+		goto allowed;
 
-	if (init == 1)
+	if (fu53_slabs[category] && fu53_slabs_generation == fu53_generation)
 	{
-		if (calls < num || num == 0)
-		{
-			if (flags & O_CREAT)
-			{
-				va_list arg;
-				mode_t mode;
-				va_start(arg, flags);
-				if (promoted)
-					mode = va_arg(arg, uint32_t);
-				else
-					mode = va_arg(arg, mode_t);
-				va_end(arg);
-				calls++;
-				return (original_open64(pathname, flags, mode));
-			}
-			calls++;
-			return (original_open64(pathname, flags));
-		}
+		fu53_slabs[category]--;
+		goto allowed;
 	}
 
-	if (getenv("WITH_COVERAGE"))
-		if (strstr(pathname, ".gcda") || strstr(pathname, ".gcno") ||
-			strstr(pathname, ".profraw") || strstr(pathname, ".profdata"))
-			return (original_open64(pathname, flags));
+	if (fu53_refill(category))
+		goto allowed;
 
-	if (flags & (O_CREAT | O_APPEND | O_WRONLY | O_RDWR | O_SYNC))
-		return (original_open64("/dev/null", flags));
+	fu53_count(id, FU53_EXHAUSTED);
+	return 0;
 
-	return (original_open64(pathname, flags));
+allowed:
+	fu53_count(id, FU53_ALLOWED);
+	return 1;
 }
 
-int openat(int dirfd, const char *pathname, int flags, ...)
+/* Checks, that file is written by coverage runtime
+ * and should be opened with original function.
+ */
+static inline int coverage(const char *pathname)
 {
-	static openat_type original_openat = NULL;
-	static int promoted = (sizeof(mode_t) < sizeof(uint32_t) - 1 ? 1 : 0);
-	static long unsigned num = 0;
-	static char init = 0;
-	static int calls = 0;
-	char *value = NULL;
-	if (!init)
-	{
-		value = getenv("WITH_OPEN");
-		if (value)
-		{
-			num = strtoul(value, NULL, 10);
-			init = 1;
-		}
+	return (fu53_policy.coverage && fu53_coverage_exempt(pathname));
+}
 
-		value = getenv("NO_OPEN");
-		if (value)
-			init = 2;
-		else 
-			init = 3;
-	}
+/* open() flags of creat().
+ */
+#define CREAT_FLAGS (O_CREAT | O_WRONLY | O_TRUNC)
 
-	if (init == 2)
-		assert(0);
+/* Checks, that open() flags can modify file.
+ */
+#define OPEN_OP(flags) ((flags) & (WRITE_FLAGS | O_TRUNC) ? FU53_OP_WRITE : FU53_OP_READ)
 
-	if (!original_openat)
-		original_openat = (openat_type)dlsym(RTLD_NEXT, "openat");
+/* Returns verdict of path rules for operation on path,
+ * which is relative to dirfd.
+ */
+static int canonical_rule(enum fu53_op op, int dirfd, const char *pathname)
+{
+	char buf[PATH_MAX];
+	const char *canonical = fu53_canon(dirfd, pathname, buf);
 
-	if (init == 1)
-	{
-		if (calls < num || num == 0)
-		{
-			if (flags & O_CREAT)
-			{
-				va_list arg;
-				mode_t mode;
-				va_start(arg, flags);
-				if (promoted)
-					mode = va_arg(arg, uint32_t);
-				else
-					mode = va_arg(arg, mode_t);
-				va_end(arg);
-				calls++;
-				return (original_openat(dirfd, pathname, flags, mode));
-			}
-			calls++;
-			return (original_openat(dirfd, pathname, flags));
-		}
-	}
+	return fu53_rule(op, canonical ? canonical : pathname);
+}
 
-	if (getenv("WITH_COVERAGE"))
-		if (strstr(pathname, ".gcda") || strstr(pathname, ".gcno") ||
-			strstr(pathname, ".profraw") || strstr(pathname, ".profdata"))
-			return (original_openat(dirfd, pathname, flags));
+static inline int rule(enum fu53_function id, enum fu53_op op, int dirfd, const char *pathname)
+{
+	int verdict;
 
-	if (flags & (O_CREAT | O_APPEND | O_WRONLY | O_RDWR | O_SYNC))
-		return (original_openat(dirfd, "/dev/null", flags));
+	if (!fu53_policy.rules)
+		return FU53_RULE_NONE;
 
-	return (original_openat(dirfd, pathname, flags));
+	verdict = canonical_rule(op, dirfd, pathname);
+	if (verdict)
+		fu53_count(id, verdict == FU53_RULE_ALLOW ? FU53_ALLOWED : FU53_BLOCKED);
+	return verdict;
 }
 
-int creat(const char *pathname, mode_t mode)
+/* Returns verdict of path rules for operation on two paths.
+ * Operation is denied, when any path is denied,
+ * and allowed, when both paths are allowed.
+ */
+static inline int rule_pair(enum fu53_function id, enum fu53_op op, int firstfd, const char *first, int secondfd, const char *second)
 {
-	static creat_type original_creat = NULL;
-	static char init = 0;
-	static long unsigned num = 0;
-	static int calls = 0;
-	char *value = NULL;
-	if (!init)
-	{
-		value = getenv("WITH_OPEN");
-		if (value)
-		{
-			num = strtoul(value, NULL, 10);
-			init = 1;
-		}
-
-		value = getenv("NO_OPEN");
-		if (value)
-			init = 2;
-		else 
-			init = 3;
-	}
-
-	if (init == 1)
-		return -1;
-	else if (init == 2)
-		assert(0);
+	int verdict, other;
 
-	if (!original_creat)
-		original_creat = (creat_type)dlsym(RTLD_NEXT, "creat");
+	if (!fu53_policy.rules)
+		return FU53_RULE_NONE;
 
-	if (calls < num || num == 0)
+	verdict = canonical_rule(op, firstfd, first);
+	if (verdict != FU53_RULE_DENY)
 	{
-		calls++;
-		return (original_creat(pathname, mode));
+		other = canonical_rule(op, secondfd, second);
+		if (other != FU53_RULE_ALLOW)
+			verdict = other;
 	}
 
-	return -1;
+	if (verdict)
+		fu53_count(id, verdict == FU53_RULE_ALLOW ? FU53_ALLOWED : FU53_BLOCKED);
+	return verdict;
 }
 
-void *dlopen(const char *filename, int flag)
+/* Returns non-zero, when original function of category can be called
+ * with verdict of path rules. Calls without verdict follow category.
+ */
+static inline int permitted(enum fu53_function id, enum fu53_category category, int verdict)
 {
-	static dlopen_type original_dlopen = NULL;
-	static char init = 0;
-	static long unsigned num = 0;
-	static int calls = 0;
-	char *value = NULL;
-	if (!init)
-	{
-		value = getenv("WITH_OPEN");
-		if (value)
-		{
-			num = strtoul(value, NULL, 10);
-			init = 1;
-		}
+	if (verdict == FU53_RULE_NONE)
+		return enabled(id, category);
 
-		value = getenv("NO_OPEN");
-		if (value)
-			init = 2;
-		else 
-			init = 3;
-	}
-
-	if (init == 1)
-		return NULL;
-	else if (init == 2)
-		assert(0);
-
-	if (!original_dlopen)
-		original_dlopen = (dlopen_type)dlsym(RTLD_NEXT, "dlopen");
+	return (verdict == FU53_RULE_ALLOW);
+}
 
-	if (calls < num || num == 0)
-	{
-		calls++;
-		return (original_dlopen(filename, flag));
-	}
+/* Returns non-zero, when original function of category can be called
+ * within budget. Call, which can't be made, is counted as blocked.
+ */
+static inline int granted(enum fu53_function id, enum fu53_category category)
+{
+	if (allowed(id, category) && budget(id, category))
+		return 1;
 
-	return NULL;
+	fu53_count(id, FU53_BLOCKED);
+	return 0;
 }
 
-FILE *fopen(const char *pathname, const char *mode)
+/* Checks, that call was denied by Landlock ruleset
+ * and should be redirected.
+ */
+static inline int denied(int ret)
 {
-	static fopen_type original_fopen = NULL;
-	static long unsigned num = 0;
-	static char init = 0;
-	static int calls = 0;
-	char *value = NULL;
-	if (!init)
-	{
-		value = getenv("WITH_OPEN");
-		if (value)
-		{
-			num = strtoul(value, NULL, 10);
-			init = 1;
-		}
-
-		value = getenv("NO_OPEN");
-		if (value)
-			init = 2;
-		else 
-			init = 3;
-	}
+	return (ret == -1 && errno == EACCES);
+}
 
-	if (init == 2)
-		assert(0);
+/* Counts call over write budgets (see writes.c) and takes
+ * FU53_WRITE_ACTION. Returns non-zero, when call should be redirected
+ * to sink, otherwise it should fail with ENOSPC.
+ */
+static int overspent(enum fu53_function id)
+{
+	unsigned char action = fu53_options.write_action;
 
-	if (!original_fopen)
-		original_fopen = (fopen_type)dlsym(RTLD_NEXT, "fopen");
+	fu53_count(id, FU53_EXHAUSTED);
 
-	if (init == 1)
+	if (action == FU53_SPENT_CRASH)
 	{
-		if (calls < num || num == 0)
-		{
-			calls++;
-			return (original_fopen(pathname, mode));
-		}
+		fu53_count(id, FU53_CRASHED);
+		assert(0);
 	}
 
-	if (getenv("WITH_COVERAGE"))
-		if (strstr(pathname, ".gcda") || strstr(pathname, ".gcno") ||
-			strstr(pathname, ".profraw") || strstr(pathname, ".profdata"))
-			return (original_fopen(pathname, mode));
+	fu53_count(id, action == FU53_SPENT_SINK ? FU53_REDIRECTED : FU53_BLOCKED);
+	return (action == FU53_SPENT_SINK);
+}
 
-	if (strchr(mode, 'w') || strchr(mode, 'a' || strchr(mode, '+')))
-		return (original_fopen("/dev/null", mode));
+/* Takes file of write budgets before permitted write-mode open,
+ * so open over budget neither creates nor truncates real file.
+ * Returns zero, when budget of files is spent.
+ */
+static inline int reserved(int flags)
+{
+	return (!fu53_policy.writes || !(flags & (WRITE_FLAGS | O_TRUNC)) || fu53_write_file());
+}
 
-	return (original_fopen(pathname, mode));
+/* Gives file back, when reserved open failed.
+ */
+static inline void unreserve(int flags)
+{
+	if (fu53_policy.writes && flags & (WRITE_FLAGS | O_TRUNC))
+		fu53_write_file_give();
 }
 
-FILE *fopen64(const char *pathname, const char *mode)
+/* Accounts descriptor of reserved open to budget of bytes.
+ */
+static inline int metered(int fd, int flags)
 {
-	static fopen64_type original_fopen64 = NULL;
-	static long unsigned num = 0;
-	static char init = 0;
-	static int calls = 0;
-	char *value = NULL;
-	if (!init)
-	{
-		value = getenv("WITH_OPEN");
-		if (value)
-		{
-			num = strtoul(value, NULL, 10);
-			init = 1;
-		}
+	fu53_fd_fresh(fd);
+	if (fd < 0)
+		unreserve(flags);
+	else if (fu53_options.write_bytes && flags & (WRITE_FLAGS | O_TRUNC))
+		fu53_fd_meter(fd);
 
-		value = getenv("NO_OPEN");
-		if (value)
-			init = 2;
-		else 
-			init = 3;
-	}
+	return fd;
+}
 
-	if (init == 2)
-		assert(0);
+/* Takes FU53_WRITE_ACTION instead of open over budget of files.
+ */
+static int spent_open(enum fu53_function id, int flags)
+{
+	if (overspent(id))
+		return fu53_sink_open(flags);
 
-	if (!original_fopen64)
-		original_fopen64 = (fopen_type)dlsym(RTLD_NEXT, "fopen64");
+	errno = ENOSPC;
+	return -1;
+}
 
-	if (init == 1)
-	{
-		if (calls < num || num == 0)
-		{
-			calls++;
-			return (original_fopen64(pathname, mode));
-		}
-	}
+/* Makes permitted open, when budget of files has file for it.
+ */
+#define METERED(id, flags, call) (reserved(flags) ? metered(call, flags) : spent_open(id, flags))
 
-	if (getenv("WITH_COVERAGE"))
-		if (strstr(pathname, ".gcda") || strstr(pathname, ".gcno") ||
-			strstr(pathname, ".profraw") || strstr(pathname, ".profdata"))
-			return (original_fopen64(pathname, mode));
+/* Stream versions of functions above. Writes of streams are made
+ * inside libc, so streams are counted by files only.
+ */
+#define STREAM_FLAGS(mode) (write_mode(mode) ? O_WRONLY : O_RDONLY)
 
-	if (strchr(mode, 'w') || strchr(mode, 'a' || strchr(mode, '+')))
-		return (original_fopen64("/dev/null", mode));
+static inline FILE *metered_stream(FILE *stream, const char *mode)
+{
+	if (!stream)
+		unreserve(STREAM_FLAGS(mode));
 
-	return (original_fopen64(pathname, mode));
+	return stream;
 }
 
-FILE *fdopen(int fildes, const char *mode)
+/* freopen() over budget keeps FILE object of caller for sink,
+ * and closes it otherwise, like failed freopen() does.
+ */
+static FILE *spent_stream(enum fu53_function id, const char *mode, FILE *stream, freopen_type reopen)
 {
-	static fdopen_type original_fdopen = NULL;
-	static long unsigned num = 0;
-	static char init = 0;
-	static int calls = 0;
-	char *value = NULL;
-	if (!init)
-	{
-		value = getenv("WITH_OPEN");
-		if (value)
-		{
-			num = strtoul(value, NULL, 10);
-			init = 1;
-		}
+	int sink = overspent(id);
 
-		value = getenv("NO_OPEN");
-		if (value)
-			init = 2;
-		else 
-			init = 3;
-	}
+	if (sink)
+		return (reopen ? reopen("/dev/null", mode, stream) : fu53_sink_stream(mode));
 
-	if (init == 2)
-		assert(0);
+	/* FILE object of null stream belongs to pool, only its file is closed */
+	if (reopen == fu53_null_reopen)
+		fu53_null_reopen("/dev/null", mode, stream);
+	else if (reopen)
+		ORIGINAL(fclose)(stream);
+
+	errno = ENOSPC;
+	return NULL;
+}
+
+#define METERED_STREAM(id, mode, call) \
+	(reserved(STREAM_FLAGS(mode)) ? metered_stream(call, mode) : spent_stream(id, mode, NULL, NULL))
 
-	if (!original_fdopen)
-		original_fdopen = (fdopen_type)dlsym(RTLD_NEXT, "fdopen");
+#define METERED_REOPEN(id, mode, call, stream, reopen) \
+	(reserved(STREAM_FLAGS(mode)) ? metered_stream(call, mode) : spent_stream(id, mode, stream, reopen))
+
+/* Opens file instead of write-mode open, which can't be passed
+ * to original function: shadow copy of file or /dev/null.
+ */
+static int redirect(int dirfd, const char *pathname, int flags)
+{
+	int fd;
 
-	if (init == 1)
+	if (fu53_policy.shadow)
 	{
-		if (calls < num || num == 0)
+		fd = fu53_shadow_open(dirfd, pathname, flags);
+		if (fd != FU53_SHADOW_NONE)
 		{
-			calls++;
-			return (original_fdopen(fildes, mode));
+			fu53_fd_set(fd, FU53_FD_SHADOW);
+			return fd;
 		}
 	}
 
-	if (strchr(mode, 'w') || strchr(mode, 'a' || strchr(mode, '+')))
-		return (fopen("/dev/null", mode));
-
-	return (original_fdopen(fildes, mode));
+	return fu53_sink_open(flags);
 }
 
-FILE *freopen(const char *path, const char *mode, FILE *stream)
+/* Opens testcase, shadow or cached copy of file for read-mode open,
+ * when it exists.
+ */
+static inline int shadowed(int dirfd, const char *pathname, int flags)
 {
-	static freopen_type original_freopen = NULL;
-	static long unsigned num = 0;
-	static char init = 0;
-	static int calls = 0;
-	char *value = NULL;
-	if (!init)
+	enum fu53_fd class = FU53_FD_VIRTUAL;
+	int fd = FU53_SHADOW_NONE;
+
+	if (fu53_policy.input)
+		fd = fu53_input_open(dirfd, pathname, flags);
+
+	if (fd == FU53_SHADOW_NONE && fu53_policy.shadow)
 	{
-		value = getenv("WITH_OPEN");
-		if (value)
-		{
-			num = strtoul(value, NULL, 10);
-			init = 1;
-		}
+		fd = fu53_shadow_find(dirfd, pathname, flags);
+		class = FU53_FD_SHADOW;
+	}
 
-		value = getenv("NO_OPEN");
-		if (value)
-			init = 2;
-		else 
-			init = 3;
+	if (fd == FU53_SHADOW_NONE && fu53_policy.cache)
+	{
+		fd = fu53_cache_open(dirfd, pathname, flags);
+		class = FU53_FD_VIRTUAL;
 	}
 
-	if (init == 2)
-		assert(0);
+	fu53_fd_set(fd, class);
+	return fd;
+}
 
-	if (!original_freopen)
-		original_freopen = (freopen_type)dlsym(RTLD_NEXT, "freopen");
+/* Opens stream instead of write-mode fopen(), which can't be passed
+ * to original function: stream over shadow copy of file or /dev/null.
+ */
+static FILE *redirect_stream(const char *pathname, const char *mode)
+{
+	FILE *stream;
+	int fd;
 
-	if (init == 1)
+	if (fu53_policy.shadow)
 	{
-		if (calls < num || num == 0)
+		fd = fu53_shadow_open(AT_FDCWD, pathname, fu53_mode_flags(mode));
+		if (fd == -1)
+			return NULL;
+
+		if (fd != FU53_SHADOW_NONE)
 		{
-			calls++;
-			return (original_freopen(path, mode, stream));
+			stream = ORIGINAL(fdopen)(fd, mode);
+			if (!stream)
+				close(fd);
+			return stream;
 		}
 	}
 
-	if (strchr(mode, 'w') || strchr(mode, 'a' || strchr(mode, '+')))
-		return (original_freopen("/dev/null", mode, stream));
-
-	return (original_freopen(path, mode, stream));
+	return fu53_sink_stream(mode);
 }
 
-int remove(const char *pathname)
+/* Opens stream over shadow of file for read-mode fopen().
+ * Returns non-zero, when file has shadow.
+ */
+static int shadowed_stream(const char *pathname, const char *mode, FILE **stream)
 {
-	static char *value;
-	static char init = 0;
-	if (!init)
-	{
-		value = getenv("WITH_REMOVE");
-		init = 1;
-	}
-
-	if (!value)
-		return -1;
+	int fd = shadowed(AT_FDCWD, pathname, fu53_mode_flags(mode));
 
-	static remove_type original_remove = NULL;
-	if (!original_remove)
-		original_remove = (remove_type)dlsym(RTLD_NEXT, "remove");
+	if (fd == FU53_SHADOW_NONE)
+		return 0;
 
-	return (original_remove(pathname));
+	*stream = (fd == -1 ? NULL : ORIGINAL(fdopen)(fd, mode));
+	if (*stream)
+		fu53_fd_forget(fd);
+	else if (fd != -1)
+		close(fd);
+	return 1;
 }
 
-int rmdir(const char *pathname)
+/* Wrappers, which are generated from table of functions
+ * (see FU53_FUNCTIONS).
+ */
+#define UNPACK(...) __VA_ARGS__
+
+#define WRAPPER(name, ret, params, args, fail, check) \
+	ret GENERIC(name) params                          \
+	{                                                 \
+		PROFILE(name);                                \
+                                                      \
+		if (!(check))                                 \
+			return fail;                              \
+                                                      \
+		return (ORIGINAL(name) args);                 \
+	}
+
+#define WRAP_CUSTOM(...)
+#define WRAP_ENABLED(name, ret, params, args, category, fail, paths) \
+	WRAPPER(name, ret, params, args, fail, enabled(FU53_FN_##name, category))
+#define WRAP_BUDGET(name, ret, params, args, category, fail, paths) \
+	WRAPPER(name, ret, params, args, fail, granted(FU53_FN_##name, category))
+#define WRAP_PATH(name, ret, params, args, category, fail, paths) \
+	WRAPPER(name, ret, params, args, fail, permitted(FU53_FN_##name, category, rule(FU53_FN_##name, UNPACK paths)))
+#define WRAP_PAIR(name, ret, params, args, category, fail, paths) \
+	WRAPPER(name, ret, params, args, fail, permitted(FU53_FN_##name, category, rule_pair(FU53_FN_##name, UNPACK paths)))
+
+#define X(name, ret, params, args, category, fail, check, paths) \
+	WRAP_##check(name, ret, params, args, category, fail, paths)
+FU53_FUNCTIONS(X)
+#undef X
+
+int GENERIC(open)(const char *pathname, int flags, ...)
 {
-	static char *value;
-	static char init = 0;
-	if (!init)
+	PROFILE(open);
+
+	open_type original_open = ORIGINAL(open);
+	static int promoted = (sizeof(mode_t) < sizeof(uint32_t) - 1 ? 1 : 0);
+	int enabled = allowed(FU53_FN_open, FU53_OPEN);
+	mode_t mode = 0;
+	int fd, verdict;
+
+	if (NEEDS_MODE(flags))
 	{
-		value = getenv("WITH_REMOVE");
-		init = 1;
+		va_list arg;
+		va_start(arg, flags);
+		if (promoted)
+			mode = va_arg(arg, uint32_t);
+		else
+			mode = va_arg(arg, mode_t);
+		va_end(arg);
 	}
 
-	if (!value)
-		return -1;
+	if ((verdict = rule(FU53_FN_open, OPEN_OP(flags), AT_FDCWD, pathname)))
+		return (verdict == FU53_RULE_ALLOW ? METERED(FU53_FN_open, flags, original_open(pathname, flags, mode)) : -1);
 
-	static rmdir_type original_rmdir = NULL;
-	if (!original_rmdir)
-		original_rmdir = (rmdir_type)dlsym(RTLD_NEXT, "rmdir");
+	/* testcase, shadow and cached copies don't spend budget */
+	if (!(flags & WRITE_FLAGS) && (fd = shadowed(AT_FDCWD, pathname, flags)) != FU53_SHADOW_NONE)
+	{
+		COUNT(open, REDIRECTED);
+		return fd;
+	}
 
-	return (original_rmdir(pathname));
-}
+	if (enabled && budget(FU53_FN_open, FU53_OPEN))
+		return (METERED(FU53_FN_open, flags, original_open(pathname, flags, mode)));
 
-int unlink(const char *fname)
-{
-	static char *value;
-	static char init = 0;
-	if (!init)
+	if (flags & WRITE_FLAGS)
 	{
-		value = getenv("WITH_REMOVE");
-		init = 1;
-	}
+		if (coverage(pathname))
+		{
+			COUNT(open, ALLOWED);
+			return (fu53_fd_fresh(original_open(pathname, flags, mode)));
+		}
 
-	if (!value)
-		return -1;
+		/* exhausted budget isn't deferred to Landlock */
+		if (fu53_policy.landlock && !enabled)
+		{
+			if (!reserved(flags))
+				return (spent_open(FU53_FN_open, flags));
+
+			fd = original_open(pathname, flags, mode);
+			if (!denied(fd))
+			{
+				COUNT(open, ALLOWED);
+				return (metered(fd, flags));
+			}
+			unreserve(flags);
+		}
 
-	static unlink_type original_unlink = NULL;
-	if (!original_unlink)
-		original_unlink = (unlink_type)dlsym(RTLD_NEXT, "unlink");
+		COUNT(open, REDIRECTED);
+		return (redirect(AT_FDCWD, pathname, flags));
+	}
 
-	return (original_unlink(fname));
+	COUNT(open, ALLOWED);
+	return (fu53_fd_fresh(original_open(pathname, flags)));
 }
 
-int unlinkat(int dirfd, const char *pathname, int flags)
+int GENERIC(open64)(const char *pathname, int flags, ...)
 {
-	static char *value;
-	static char init = 0;
-	if (!init)
+	PROFILE(open64);
+
+	open64_type original_open64 = ORIGINAL(open64);
+	static int promoted = (sizeof(mode_t) < sizeof(uint32_t) - 1 ? 1 : 0);
+	int enabled = allowed(FU53_FN_open64, FU53_OPEN);
+	mode_t mode = 0;
+	int fd, verdict;
+
+	if (NEEDS_MODE(flags))
 	{
-		value = getenv("WITH_REMOVE");
-		init = 1;
+		va_list arg;
+		va_start(arg, flags);
+		if (promoted)
+			mode = va_arg(arg, uint32_t);
+		else
+			mode = va_arg(arg, mode_t);
+		va_end(arg);
 	}
 
-	if (!value)
-		return -1;
+	if ((verdict = rule(FU53_FN_open64, OPEN_OP(flags), AT_FDCWD, pathname)))
+		return (verdict == FU53_RULE_ALLOW ? METERED(FU53_FN_open64, flags, original_open64(pathname, flags, mode)) : -1);
 
-	static unlinkat_type original_unlinkat = NULL;
-	if (!original_unlinkat)
-		original_unlinkat = (unlinkat_type)dlsym(RTLD_NEXT, "unlinkat");
+	/* testcase, shadow and cached copies don't spend budget */
+	if (!(flags & WRITE_FLAGS) && (fd = shadowed(AT_FDCWD, pathname, flags)) != FU53_SHADOW_NONE)
+	{
+		COUNT(open64, REDIRECTED);
+		return fd;
+	}
 
-	return (original_unlinkat(dirfd, pathname, flags));
-}
+	if (enabled && budget(FU53_FN_open64, FU53_OPEN))
+		return (METERED(FU53_FN_open64, flags, original_open64(pathname, flags, mode)));
 
-int execv(const char *path, char *const argv[])
-{
-	static char *value;
-	static char init = 0;
-	if (!init)
+	if (flags & WRITE_FLAGS)
 	{
-		value = getenv("WITH_EXEC");
-		init = 1;
-	}
+		if (coverage(pathname))
+		{
+			COUNT(open64, ALLOWED);
+			return (fu53_fd_fresh(original_open64(pathname, flags, mode)));
+		}
 
-	if (!value)
-		return -1;
+		/* exhausted budget isn't deferred to Landlock */
+		if (fu53_policy.landlock && !enabled)
+		{
+			if (!reserved(flags))
+				return (spent_open(FU53_FN_open64, flags));
+
+			fd = original_open64(pathname, flags, mode);
+			if (!denied(fd))
+			{
+				COUNT(open64, ALLOWED);
+				return (metered(fd, flags));
+			}
+			unreserve(flags);
+		}
 
-	static execv_type original_execv = NULL;
-	if (!original_execv)
-		original_execv = (execv_type)dlsym(RTLD_NEXT, "execv");
+		COUNT(open64, REDIRECTED);
+		return (redirect(AT_FDCWD, pathname, flags));
+	}
 
-	return (original_execv(path, argv));
+	COUNT(open64, ALLOWED);
+	return (fu53_fd_fresh(original_open64(pathname, flags)));
 }
 
-int execve(const char *path, char *const argv[], char *const envp[])
+int GENERIC(openat)(int dirfd, const char *pathname, int flags, ...)
 {
-	static char init = 0;
-	char *value = NULL;
-	if (!init)
+	PROFILE(openat);
+
+	openat_type original_openat = ORIGINAL(openat);
+	static int promoted = (sizeof(mode_t) < sizeof(uint32_t) - 1 ? 1 : 0);
+	int enabled = allowed(FU53_FN_openat, FU53_OPEN);
+	mode_t mode = 0;
+	int fd, verdict;
+
+	if (NEEDS_MODE(flags))
 	{
-		value = getenv("WITH_EXEC");
-		if (value)
-			init = 1;
-		value = getenv("NO_EXEC");
-		if (value)	
-			init = 2;
+		va_list arg;
+		va_start(arg, flags);
+		if (promoted)
+			mode = va_arg(arg, uint32_t);
 		else
-			init = 3;
+			mode = va_arg(arg, mode_t);
+		va_end(arg);
 	}
 
-	if (init == 2)
-		assert(0);
-	else if (init == 3)
-		return -1;
+	if ((verdict = rule(FU53_FN_openat, OPEN_OP(flags), dirfd, pathname)))
+		return (verdict == FU53_RULE_ALLOW ? METERED(FU53_FN_openat, flags, original_openat(dirfd, pathname, flags, mode)) : -1);
 
-	static execve_type original_execve = NULL;
-	if (!original_execve)
-		original_execve = (execve_type)dlsym(RTLD_NEXT, "execve");
+	/* testcase, shadow and cached copies don't spend budget */
+	if (!(flags & WRITE_FLAGS) && (fd = shadowed(dirfd, pathname, flags)) != FU53_SHADOW_NONE)
+	{
+		COUNT(openat, REDIRECTED);
+		return fd;
+	}
 
-	return (original_execve(path, argv, envp));
-}
+	if (enabled && budget(FU53_FN_openat, FU53_OPEN))
+		return (METERED(FU53_FN_openat, flags, original_openat(dirfd, pathname, flags, mode)));
 
-int execvp(const char *file, char *const argv[])
-{
-	static char init = 0;
-	char *value = NULL;
-	if (!init)
+	if (flags & WRITE_FLAGS)
 	{
-		value = getenv("WITH_EXEC");
-		if (value)
-			init = 1;
-		value = getenv("NO_EXEC");
-		if (value)	
-			init = 2;
-		else
-			init = 3;
-	}
+		if (coverage(pathname))
+		{
+			COUNT(openat, ALLOWED);
+			return (fu53_fd_fresh(original_openat(dirfd, pathname, flags, mode)));
+		}
 
-	if (init == 2)
-		assert(0);
-	else if (init == 3)
-		return -1;
+		/* exhausted budget isn't deferred to Landlock */
+		if (fu53_policy.landlock && !enabled)
+		{
+			if (!reserved(flags))
+				return (spent_open(FU53_FN_openat, flags));
 
-	static execvp_type original_execvp = NULL;
-	if (!original_execvp)
-		original_execvp = (execvp_type)dlsym(RTLD_NEXT, "execvp");
+			fd = original_openat(dirfd, pathname, flags, mode);
+			if (!denied(fd))
+			{
+				COUNT(openat, ALLOWED);
+				return (metered(fd, flags));
+			}
+			unreserve(flags);
+		}
 
-	return (original_execvp(file, argv));
+		COUNT(openat, REDIRECTED);
+		return (redirect(dirfd, pathname, flags));
+	}
+
+	COUNT(openat, ALLOWED);
+	return (fu53_fd_fresh(original_openat(dirfd, pathname, flags)));
 }
 
-int execvpe(const char *file, char *const argv[], char *const envp[])
+int EXPORT(creat)(const char *pathname, mode_t mode)
 {
-	static char init = 0;
-	char *value = NULL;
-	if (!init)
-	{
-		value = getenv("WITH_EXEC");
-		if (value)
-			init = 1;
-		value = getenv("NO_EXEC");
-		if (value)	
-			init = 2;
-		else
-			init = 3;
-	}
+	PROFILE(creat);
 
-	if (init == 2)
-		assert(0);
-	else if (init == 3)
-		return -1;
+	creat_type original_creat = ORIGINAL(creat);
+	int enabled = allowed(FU53_FN_creat, FU53_OPEN);
+	int fd, verdict = rule(FU53_FN_creat, FU53_OP_WRITE, AT_FDCWD, pathname);
 
-	static execvpe_type original_execvpe = NULL;
-	if (!original_execvpe)
-		original_execvpe = (execvpe_type)dlsym(RTLD_NEXT, "execvpe");
+	if (verdict)
+		return (verdict == FU53_RULE_ALLOW ? METERED(FU53_FN_creat, CREAT_FLAGS, original_creat(pathname, mode)) : -1);
 
-	return (original_execvpe(file, argv, envp));
-}
+	if (enabled && budget(FU53_FN_creat, FU53_OPEN))
+		return (METERED(FU53_FN_creat, CREAT_FLAGS, original_creat(pathname, mode)));
 
-int execveat(int dirfd, const char *pathname, char *const argv[], char *const envp[], int flags)
-{
-	static char init = 0;
-	char *value = NULL;
-	if (!init)
+	if (coverage(pathname))
 	{
-		value = getenv("WITH_EXEC");
-		if (value)
-			init = 1;
-		value = getenv("NO_EXEC");
-		if (value)	
-			init = 2;
-		else
-			init = 3;
+		COUNT(creat, ALLOWED);
+		return (fu53_fd_fresh(original_creat(pathname, mode)));
 	}
 
-	if (init == 2)
-		assert(0);
-	else if (init == 3)
-		return -1;
+	/* exhausted budget isn't deferred to Landlock */
+	if (fu53_policy.landlock && !enabled)
+	{
+		if (!reserved(CREAT_FLAGS))
+			return (spent_open(FU53_FN_creat, CREAT_FLAGS));
 
-	static execveat_type original_execveat = NULL;
-	if (!original_execveat)
-		original_execveat = (execveat_type)dlsym(RTLD_NEXT, "execveat");
+		fd = original_creat(pathname, mode);
+		if (!denied(fd))
+		{
+			COUNT(creat, ALLOWED);
+			return (metered(fd, CREAT_FLAGS));
+		}
+		unreserve(CREAT_FLAGS);
+	}
 
-	return (original_execveat(dirfd, pathname, argv, envp, flags));
+	COUNT(creat, REDIRECTED);
+	return (redirect(AT_FDCWD, pathname, CREAT_FLAGS));
 }
 
-int fexecve(int fd, char *const argv[], char *const envp[])
+FILE *GENERIC(fopen)(const char *pathname, const char *mode)
 {
-	static char init = 0;
-	char *value = NULL;
-	if (!init)
+	PROFILE(fopen);
+
+	fopen_type original_fopen = ORIGINAL(fopen);
+	int enabled = allowed(FU53_FN_fopen, FU53_OPEN);
+	FILE *stream;
+	int verdict;
+
+	if ((verdict = rule(FU53_FN_fopen, write_mode(mode) ? FU53_OP_WRITE : FU53_OP_READ, AT_FDCWD, pathname)))
+		return (verdict == FU53_RULE_ALLOW ? METERED_STREAM(FU53_FN_fopen, mode, original_fopen(pathname, mode)) : NULL);
+
+	/* testcase, shadow and cached copies don't spend budget */
+	if (!write_mode(mode) && shadowed_stream(pathname, mode, &stream))
 	{
-		value = getenv("WITH_EXEC");
-		if (value)
-			init = 1;
-		value = getenv("NO_EXEC");
-		if (value)	
-			init = 2;
-		else
-			init = 3;
+		COUNT(fopen, REDIRECTED);
+		return stream;
 	}
 
-	if (init == 2)
-		assert(0);
-	else if (init == 3)
-		return -1;
+	if (enabled && budget(FU53_FN_fopen, FU53_OPEN))
+		return (METERED_STREAM(FU53_FN_fopen, mode, original_fopen(pathname, mode)));
+
+	if (write_mode(mode))
+	{
+		if (coverage(pathname))
+		{
+			COUNT(fopen, ALLOWED);
+			return (original_fopen(pathname, mode));
+		}
+
+		/* exhausted budget isn't deferred to Landlock */
+		if (fu53_policy.landlock && !enabled)
+		{
+			if (!reserved(STREAM_FLAGS(mode)))
+				return (spent_stream(FU53_FN_fopen, mode, NULL, NULL));
+
+			stream = original_fopen(pathname, mode);
+			if (stream || errno != EACCES)
+			{
+				COUNT(fopen, ALLOWED);
+				return (metered_stream(stream, mode));
+			}
+			unreserve(STREAM_FLAGS(mode));
+		}
 
-	static fexecve_type original_fexecve = NULL;
-	if (!original_fexecve)
-		original_fexecve = (fexecve_type)dlsym(RTLD_NEXT, "fexecve");
+		COUNT(fopen, REDIRECTED);
+		return (redirect_stream(pathname, mode));
+	}
 
-	return (original_fexecve(fd, argv, envp));
+	COUNT(fopen, ALLOWED);
+	return (original_fopen(pathname, mode));
 }
 
-int execl(const char *path, const char *arg, ...)
+FILE *GENERIC(fopen64)(const char *pathname, const char *mode)
 {
-	static char init = 0;
-	char *value = NULL;
-	if (!init)
+	PROFILE(fopen64);
+
+	fopen64_type original_fopen64 = ORIGINAL(fopen64);
+	int enabled = allowed(FU53_FN_fopen64, FU53_OPEN);
+	FILE *stream;
+	int verdict;
+
+	if ((verdict = rule(FU53_FN_fopen64, write_mode(mode) ? FU53_OP_WRITE : FU53_OP_READ, AT_FDCWD, pathname)))
+		return (verdict == FU53_RULE_ALLOW ? METERED_STREAM(FU53_FN_fopen64, mode, original_fopen64(pathname, mode)) : NULL);
+
+	/* testcase, shadow and cached copies don't spend budget */
+	if (!write_mode(mode) && shadowed_stream(pathname, mode, &stream))
 	{
-		value = getenv("WITH_EXEC");
-		if (value)
-			init = 1;
-		value = getenv("NO_EXEC");
-		if (value)	
-			init = 2;
-		else
-			init = 3;
+		COUNT(fopen64, REDIRECTED);
+		return stream;
 	}
 
-	if (init == 2)
-		assert(0);
-	else if (init == 3)
-		return -1;
+	if (enabled && budget(FU53_FN_fopen64, FU53_OPEN))
+		return (METERED_STREAM(FU53_FN_fopen64, mode, original_fopen64(pathname, mode)));
 
-	va_list ap;
-	va_start(ap, arg);
-	unsigned int argc = 1;
-	for (; va_arg(ap, const char *); argc++)
-		if (argc == INT_MAX)
+	if (write_mode(mode))
+	{
+		if (coverage(pathname))
 		{
-			va_end(ap);
-			return -1;
+			COUNT(fopen64, ALLOWED);
+			return (original_fopen64(pathname, mode));
 		}
-	va_end(ap);
 
-	va_start(ap, arg);
-	char *argv[argc + 1];
-	argv[0] = (char *)arg;
+		/* exhausted budget isn't deferred to Landlock */
+		if (fu53_policy.landlock && !enabled)
+		{
+			if (!reserved(STREAM_FLAGS(mode)))
+				return (spent_stream(FU53_FN_fopen64, mode, NULL, NULL));
 
-	for (int i = 1; i <= argc; i++)
-		argv[i] = va_arg(ap, char *);
+			stream = original_fopen64(pathname, mode);
+			if (stream || errno != EACCES)
+			{
+				COUNT(fopen64, ALLOWED);
+				return (metered_stream(stream, mode));
+			}
+			unreserve(STREAM_FLAGS(mode));
+		}
 
-	va_end(ap);
+		COUNT(fopen64, REDIRECTED);
+		return (redirect_stream(pathname, mode));
+	}
 
-	return (execv(path, argv));
+	COUNT(fopen64, ALLOWED);
+	return (original_fopen64(pathname, mode));
 }
 
-int execlp(const char *file, const char *arg, ...)
+FILE *EXPORT(fdopen)(int fildes, const char *mode)
 {
-	static char init = 0;
-	char *value = NULL;
-	if (!init)
+	PROFILE(fdopen);
+
+	fdopen_type original_fdopen = ORIGINAL(fdopen);
+	int enabled = allowed(FU53_FN_fdopen, FU53_OPEN);
+
+	fu53_fd_forget(fildes);
+
+	if (enabled && budget(FU53_FN_fdopen, FU53_OPEN))
+		return (original_fdopen(fildes, mode));
+
+	if (write_mode(mode))
 	{
-		value = getenv("WITH_EXEC");
-		if (value)
-			init = 1;
-		value = getenv("NO_EXEC");
-		if (value)	
-			init = 2;
-		else
-			init = 3;
+		COUNT(fdopen, REDIRECTED);
+		return fu53_sink_stream(mode);
 	}
 
-	if (init == 2)
-		assert(0);
-	else if (init == 3)
-		return -1;
+	COUNT(fdopen, ALLOWED);
+	return (original_fdopen(fildes, mode));
+}
+
+FILE *EXPORT(freopen)(const char *path, const char *mode, FILE *stream)
+{
+	PROFILE(freopen);
+
+	freopen_type original_freopen = ORIGINAL(freopen);
+	int enabled = allowed(FU53_FN_freopen, FU53_OPEN);
+	int verdict, fd = fileno(stream);
+
+	if (fu53_null_owned(stream))
+		original_freopen = fu53_null_reopen;
+
+	/* old descriptor is closed inside libc */
+	fu53_fd_forget(fd);
+	fu53_canon_forget(fd);
+
+	if (path && (verdict = rule(FU53_FN_freopen, write_mode(mode) ? FU53_OP_WRITE : FU53_OP_READ, AT_FDCWD, path)))
+		return (verdict == FU53_RULE_ALLOW ? METERED_REOPEN(FU53_FN_freopen, mode, original_freopen(path, mode, stream), stream, original_freopen) : NULL);
+
+	if (enabled && budget(FU53_FN_freopen, FU53_OPEN))
+		return (METERED_REOPEN(FU53_FN_freopen, mode, original_freopen(path, mode, stream), stream, original_freopen));
 
+	if (write_mode(mode))
+	{
+		COUNT(freopen, REDIRECTED);
+		return (original_freopen("/dev/null", mode, stream));
+	}
+
+	COUNT(freopen, ALLOWED);
+	return (original_freopen(path, mode, stream));
+}
+int EXPORT(execl)(const char *path, const char *arg, ...)
+{
 	va_list ap;
 	va_start(ap, arg);
 	unsigned int argc = 1;
@@ -818,40 +862,19 @@ int execlp(const char *file, const char *arg, ...)
 	va_end(ap);
 
 	va_start(ap, arg);
-	char **envp;
 	char *argv[argc + 1];
 	argv[0] = (char *)arg;
 
 	for (int i = 1; i <= argc; i++)
 		argv[i] = va_arg(ap, char *);
 
-	envp = va_arg(ap, char **);
 	va_end(ap);
 
-	return (execvpe(file, argv, envp));
+	return (execv(path, argv));
 }
 
-int execle(const char *path, const char *arg, ...)
+int EXPORT(execlp)(const char *file, const char *arg, ...)
 {
-	static char init = 0;
-	char *value = NULL;
-	if (!init)
-	{
-		value = getenv("WITH_EXEC");
-		if (value)
-			init = 1;
-		value = getenv("NO_EXEC");
-		if (value)	
-			init = 2;
-		else
-			init = 3;
-	}
-
-	if (init == 2)
-		assert(0);
-	else if (init == 3)
-		return -1;
-
 	va_list ap;
 	va_start(ap, arg);
 	unsigned int argc = 1;
@@ -874,186 +897,44 @@ int execle(const char *path, const char *arg, ...)
 	envp = va_arg(ap, char **);
 	va_end(ap);
 
-	return (execve(path, argv, envp));
-}
-
-int rename(const char *oldpath, const char *newpath)
-{
-	static char *value;
-	static char init = 0;
-	if (!init)
-	{
-		value = getenv("WITH_RENAME");
-		init = 1;
-	}
-
-	if (!value)
-		return -1;
-
-	static rename_type original_rename = NULL;
-	if (!original_rename)
-		original_rename = (rename_type)dlsym(RTLD_NEXT, "rename");
-
-	return (original_rename(oldpath, newpath));
-}
-
-int renameat(int olddirfd, const char *oldpath, int newdirfd, const char *newpath)
-{
-	static char *value;
-	static char init = 0;
-	if (!init)
-	{
-		value = getenv("WITH_RENAME");
-		init = 1;
-	}
-
-	if (!value)
-		return -1;
-
-	static renameat_type original_renameat = NULL;
-	if (!original_renameat)
-		original_renameat = (renameat_type)dlsym(RTLD_NEXT, "renameat");
-
-	return (original_renameat(olddirfd, oldpath, newdirfd, newpath));
-}
-
-int renameat2(int olddirfd, const char *oldpath, int newdirfd, const char *newpath, unsigned int flags)
-{
-	static char *value;
-	static char init = 0;
-	if (!init)
-	{
-		value = getenv("WITH_RENAME");
-		init = 1;
-	}
-
-	if (!value)
-		return -1;
-
-	static renameat2_type original_renameat2 = NULL;
-	if (!original_renameat2)
-		original_renameat2 = (renameat2_type)dlsym(RTLD_NEXT, "renameat2");
-
-	return (original_renameat2(olddirfd, oldpath, newdirfd, newpath, flags));
-}
-
-int chown(const char *path, uid_t owner, gid_t group)
-{
-	static char *value;
-	static char init = 0;
-	if (!init)
-	{
-		value = getenv("WITH_CHANGE");
-		init = 1;
-	}
-
-	if (!value)
-		return -1;
-
-	static chown_type original_chown = NULL;
-	if (!original_chown)
-		original_chown = (chown_type)dlsym(RTLD_NEXT, "chown");
-
-	return (original_chown(path, owner, group));
-}
-
-int fchownat(int dirfd, const char *pathname, uid_t owner, gid_t group, int flags)
-{
-	static char *value;
-	static char init = 0;
-	if (!init)
-	{
-		value = getenv("WITH_CHANGE");
-		init = 1;
-	}
-
-	if (!value)
-		return -1;
-
-	static fchownat_type original_fchownat = NULL;
-	if (!original_fchownat)
-		original_fchownat = (fchownat_type)dlsym(RTLD_NEXT, "fchownat");
-
-	return (original_fchownat(dirfd, pathname, owner, group, flags));
-}
-
-int chmod(const char *pathname, mode_t mode)
-{
-	static char *value;
-	static char init = 0;
-	if (!init)
-	{
-		value = getenv("WITH_CHANGE");
-		init = 1;
-	}
-
-	if (!value)
-		return -1;
-
-	static chmod_type original_chmod = NULL;
-	if (!original_chmod)
-		original_chmod = (chmod_type)dlsym(RTLD_NEXT, "chmod");
-
-	return (original_chmod(pathname, mode));
-}
-
-int fchmodat(int dirfd, const char *pathname, mode_t mode, int flags)
-{
-	static char *value;
-	static char init = 0;
-	if (!init)
-	{
-		value = getenv("WITH_CHANGE");
-		init = 1;
-	}
-
-	if (!value)
-		return -1;
-
-	static fchmodat_type original_fchmodat = NULL;
-	if (!original_fchmodat)
-		original_fchmodat = (fchmodat_type)dlsym(RTLD_NEXT, "fchmodat");
-
-	return (original_fchmodat(dirfd, pathname, mode, flags));
+	return (execvpe(file, argv, envp));
 }
 
-int system(const char *command)
+int EXPORT(execle)(const char *path, const char *arg, ...)
 {
-	static char *value;
-	static char init = 0;
-	if (!init)
-	{
-		value = getenv("WITH_SYSTEM");
-		init = 1;
-	}
+	va_list ap;
+	va_start(ap, arg);
+	unsigned int argc = 1;
+	for (; va_arg(ap, const char *); argc++)
+		if (argc == INT_MAX)
+		{
+			va_end(ap);
+			return -1;
+		}
+	va_end(ap);
 
-	if (!value)
-		return -1;
+	va_start(ap, arg);
+	char **envp;
+	char *argv[argc + 1];
+	argv[0] = (char *)arg;
+
+	for (int i = 1; i <= argc; i++)
+		argv[i] = va_arg(ap, char *);
 
-	static system_type original_system = NULL;
-	if (!original_system)
-		original_system = (system_type)dlsym(RTLD_NEXT, "system");
+	envp = va_arg(ap, char **);
+	va_end(ap);
 
-	return (original_system(command));
+	return (execve(path, argv, envp));
 }
 
-long syscall(long number, ...)
+long EXPORT(syscall)(long number, ...)
 {
-	static char *value;
-	static char init = 0;
-	if (!init)
-	{
-		value = getenv("WITH_SYSTEM");
-		init = 1;
-	}
+	PROFILE(syscall);
 
-	if (!value)
+	if (!enabled(FU53_FN_syscall, FU53_SYSTEM))
 		return -1;
 
-	static syscall_type original_syscall = NULL;
-	if (!original_syscall)
-		original_syscall = (syscall_type)dlsym(RTLD_NEXT, "syscall");
-
+	syscall_type original_syscall = ORIGINAL(syscall);
 	va_list args;
 
 	va_start(args, number);
@@ -1065,231 +946,108 @@ long syscall(long number, ...)
 	long int a5 = va_arg(args, long int);
 	va_end(args);
 
-	return (original_syscall(number, a0, a1, a2, a3, a4, a5));
-}
-
-int chroot(const char *path)
-{
-	static char *value;
-	static char init = 0;
-	if (!init)
-	{
-		value = getenv("WITH_SYSTEM");
-		init = 1;
-	}
-
-	if (!value)
-		return -1;
-
-	static chroot_type original_chroot = NULL;
-	if (!original_chroot)
-		original_chroot = (chroot_type)dlsym(RTLD_NEXT, "chroot");
-
-	return (original_chroot(path));
-}
-
-pid_t fork(void)
-{
-	static fork_type original_fork = NULL;
-	static char *value;
-	static char init = 0;
-	static long unsigned num = 0;
-	static int calls = 0;
-	if (!init)
-	{
-		value = getenv("WITH_FORK");
-		if (value)
-			num = strtoul(value, NULL, 10);
-		init = 1;
-	}
-
-	if (value)
+	/* descriptors, closed behind wrappers, must be forgotten */
+	if (number == SYS_close)
 	{
-		if (!original_fork)
-			original_fork = (fork_type)dlsym(RTLD_NEXT, "fork");
-
-		if (calls < num || num == 0)
-		{
-			calls++;
-			return (original_fork());
-		}
+		fu53_fd_forget(a0);
+		fu53_canon_forget(a0);
 	}
+	else if (number == SYS_close_range && !(a2 & CLOSE_RANGE_CLOEXEC))
+		fu53_fd_forget_range(a0, a1);
 
-	return -1;
+	return (original_syscall(number, a0, a1, a2, a3, a4, a5));
 }
 
-FILE *popen(const char *command, const char *type)
+int EXPORT(mkfifo)(const char *pathname, mode_t mode)
 {
-	static popen_type original_popen = NULL;
-	static char *value;
-	static char init = 0;
-	static long unsigned num = 0;
-	static int calls = 0;
-	if (!init)
-	{
-		value = getenv("WITH_PARALLEL");
-		if (value)
-			num = strtoul(value, NULL, 10);
-		init = 1;
-	}
-
-	if (value)
-	{
-		if (!original_popen)
-			original_popen = (popen_type)dlsym(RTLD_NEXT, "popen");
-
-		if (calls < num || num == 0)
-		{
-			calls++;
-			return (original_popen(command, type));
-		}
-	}
+	PROFILE(mkfifo);
 
-	return NULL;
-}
+	mkfifo_type original_mkfifo = ORIGINAL(mkfifo);
+	int verdict = rule(FU53_FN_mkfifo, FU53_OP_WRITE, AT_FDCWD, pathname);
 
-int mkfifo(const char *pathname, mode_t mode)
-{
-	static mkfifo_type original_mkfifo = NULL;
-	static char *value;
-	static char init = 0;
-	static long unsigned num = 0;
-	static int calls = 0;
-	if (!init)
-	{
-		value = getenv("WITH_PARALLEL");
-		if (value)
-			num = strtoul(value, NULL, 10);
-		init = 1;
-	}
+	if (verdict)
+		return (verdict == FU53_RULE_ALLOW ? original_mkfifo(pathname, mode) : -1);
 
-	if (value)
+	if (allowed(FU53_FN_mkfifo, FU53_PARALLEL))
 	{
-		if (!original_mkfifo)
-			original_mkfifo = (mkfifo_type)dlsym(RTLD_NEXT, "mkfifo");
-
-		if (calls < num || num == 0)
-		{
-			calls++;
+		if (budget(FU53_FN_mkfifo, FU53_PARALLEL))
 			return (original_mkfifo(pathname, mode));
-		}
 	}
 
+	COUNT(mkfifo, BLOCKED);
 	return -1;
 }
 
-int mkfifoat(int dirfd, const char *pathname, mode_t mode)
+int EXPORT(mkfifoat)(int dirfd, const char *pathname, mode_t mode)
 {
-	static mkfifoat_type original_mkfifoat = NULL;
-	static char *value;
-	static char init = 0;
-	static long unsigned num = 0;
-	static int calls = 0;
-	if (!init)
-	{
-		value = getenv("WITH_PARALLEL");
-		if (value)
-			num = strtoul(value, NULL, 10);
-		init = 1;
-	}
+	PROFILE(mkfifoat);
 
-	if (value)
-	{
-		if (!original_mkfifoat)
-			original_mkfifoat = (mkfifoat_type)dlsym(RTLD_NEXT, "mkfifoat");
+	mkfifoat_type original_mkfifoat = ORIGINAL(mkfifoat);
+	int verdict = rule(FU53_FN_mkfifoat, FU53_OP_WRITE, dirfd, pathname);
 
-		if (calls < num || num == 0)
-		{
-			calls++;
+	if (verdict)
+		return (verdict == FU53_RULE_ALLOW ? original_mkfifoat(dirfd, pathname, mode) : -1);
+
+	if (allowed(FU53_FN_mkfifoat, FU53_PARALLEL))
+	{
+		if (budget(FU53_FN_mkfifoat, FU53_PARALLEL))
 			return (original_mkfifoat(dirfd, pathname, mode));
-		}
 	}
 
+	COUNT(mkfifoat, BLOCKED);
 	return -1;
 }
 
-int mknod(const char *pathname, mode_t mode, dev_t dev)
+int EXPORT(mknod)(const char *pathname, mode_t mode, dev_t dev)
 {
-	static mknod_type original_mknod = NULL;
-	static char *value;
-	static char init = 0;
-	static long unsigned num = 0;
-	static int calls = 0;
-	if (!init)
-	{
-		value = getenv("WITH_PARALLEL");
-		if (value)
-			num = strtoul(value, NULL, 10);
-		init = 1;
-	}
+	PROFILE(mknod);
+
+	mknod_type original_mknod = ORIGINAL(mknod);
+	int verdict = rule(FU53_FN_mknod, FU53_OP_WRITE, AT_FDCWD, pathname);
 
-	if (value)
+	if (verdict)
+		return (verdict == FU53_RULE_ALLOW ? original_mknod(pathname, mode, dev) : -1);
+
+	if (allowed(FU53_FN_mknod, FU53_PARALLEL))
 	{
-		if (!original_mknod)
-			original_mknod = (mknod_type)dlsym(RTLD_NEXT, "mknod");
-		
-		if (calls < num || num == 0)
-		{
-			calls++;
+		if (budget(FU53_FN_mknod, FU53_PARALLEL))
 			return (original_mknod(pathname, mode, dev));
-		}
 	}
 
+	COUNT(mknod, BLOCKED);
 	return -1;
 }
 
-int mknodat(int dirfd, const char *pathname, mode_t mode, dev_t dev)
+int EXPORT(mknodat)(int dirfd, const char *pathname, mode_t mode, dev_t dev)
 {
-	static mknodat_type original_mknodat = NULL;
-	static char *value;
-	static char init = 0;
-	static long unsigned num = 0;
-	static int calls = 0;
-	if (!init)
-	{
-		value = getenv("WITH_PARALLEL");
-		if (value)
-			num = strtoul(value, NULL, 10);
-		init = 1;
-	}
+	PROFILE(mknodat);
 
-	if (value)
-	{
-		if (!original_mknodat)
-			original_mknodat = (mknodat_type)dlsym(RTLD_NEXT, "mknodat");
+	mknodat_type original_mknodat = ORIGINAL(mknodat);
+	int verdict = rule(FU53_FN_mknodat, FU53_OP_WRITE, dirfd, pathname);
 
-		if (calls < num || num == 0)
-		{
-			calls++;
+	if (verdict)
+		return (verdict == FU53_RULE_ALLOW ? original_mknodat(dirfd, pathname, mode, dev) : -1);
+
+	if (allowed(FU53_FN_mknodat, FU53_PARALLEL))
+	{
+		if (budget(FU53_FN_mknodat, FU53_PARALLEL))
 			return (original_mknodat(dirfd, pathname, mode, dev));
-		}
 	}
 
+	COUNT(mknodat, BLOCKED);
 	return -1;
 }
 
-sem_t *sem_open(const char *name, int oflag, ...)
+sem_t *EXPORT(sem_open)(const char *name, int oflag, ...)
 {
-	static sem_open_type original_sem_open = NULL;
-	static char *value;
-	static char init = 0;
-	static long unsigned num = 0;
-	static int calls = 0;
-	if (!init)
-	{
-		value = getenv("WITH_PARALLEL");
-		if (value)
-			num = strtoul(value, NULL, 10);
-		init = 1;
-	}
+	PROFILE(sem_open);
 
-	if (value)
+	sem_open_type original_sem_open = ORIGINAL(sem_open);
+
+	if (allowed(FU53_FN_sem_open, FU53_PARALLEL))
 	{
-		if (calls < num || num == 0)
+		if (budget(FU53_FN_sem_open, FU53_PARALLEL))
 		{
-			if (!original_sem_open)
-				original_sem_open = (sem_open_type)dlsym(RTLD_NEXT, "sem_open");
-
 			if (oflag & O_CREAT)
 			{
 				va_list args;
@@ -1300,39 +1058,26 @@ sem_t *sem_open(const char *name, int oflag, ...)
 				mode = va_arg(args, mode_t);
 				value = va_arg(args, unsigned int);
 				va_end(args);
-				calls++;
 				return (original_sem_open(name, oflag, mode, value));
 			}
 
-			calls++;
 			return (original_sem_open(name, oflag));
 		}
 	}
 
+	COUNT(sem_open, BLOCKED);
 	return SEM_FAILED;
 }
 
-int semctl(int semid, int semnum, int cmd, ...)
+int EXPORT(semctl)(int semid, int semnum, int cmd, ...)
 {
-	static semctl_type original_semctl = NULL;
-	static char *value;
-	static char init = 0;
-	static long unsigned num = 0;
-	static int calls = 0;
-	if (!init)
-	{
-		value = getenv("WITH_PARALLEL");
-		if (value)
-			num = strtoul(value, NULL, 10);
-		init = 1;
-	}
+	PROFILE(semctl);
 
-	if (value)
-	{
-		if (!original_semctl)
-			original_semctl = (semctl_type)dlsym(RTLD_NEXT, "semctl");
+	semctl_type original_semctl = ORIGINAL(semctl);
 
-		if (calls < num || num == 0)
+	if (allowed(FU53_FN_semctl, FU53_PARALLEL))
+	{
+		if (budget(FU53_FN_semctl, FU53_PARALLEL))
 		{
 			union semun
 			{
@@ -1357,214 +1102,498 @@ int semctl(int semid, int semnum, int cmd, ...)
 				va_start(args, cmd);
 				arg = va_arg(args, union semun);
 				va_end(args);
-				calls++;
 				return (original_semctl(semid, semnum, cmd, arg));
 			}
 
-			calls++;
 			return (original_semctl(semid, semnum, cmd));
 		}
 	}
 
+	COUNT(semctl, BLOCKED);
 	return -1;
 }
 
-int semget(key_t key, int nsems, int semflg)
+int EXPORT(dup)(int oldfd)
+{
+	PROFILE(dup);
+
+	if (!enabled(FU53_FN_dup, FU53_DUP))
+		return -1;
+
+	dup_type original_dup = ORIGINAL(dup);
+	int fd = original_dup(oldfd);
+
+	if (fd != -1)
+		fu53_fd_dup(oldfd, fd);
+
+	return fd;
+}
+
+int EXPORT(dup2)(int oldfd, int newfd)
 {
-	static semget_type original_semget = NULL;
-	static char *value;
-	static char init = 0;
-	static long unsigned num = 0;
-	static int calls = 0;
-	if (!init)
+	PROFILE(dup2);
+
+	if (!enabled(FU53_FN_dup2, FU53_DUP))
+		return -1;
+
+	dup2_type original_dup2 = ORIGINAL(dup2);
+	int fd = original_dup2(oldfd, newfd);
+
+	if (fd != -1)
 	{
-		value = getenv("WITH_PARALLEL");
-		if (value)
-			num = strtoul(value, NULL, 10);
-		init = 1;
+		fu53_fd_dup(oldfd, fd);
+		fu53_canon_forget(fd);
 	}
 
-	if (value)
+	return fd;
+}
+
+int EXPORT(dup3)(int oldfd, int newfd, int flags)
+{
+	PROFILE(dup3);
+
+	if (!enabled(FU53_FN_dup3, FU53_DUP))
+		return -1;
+
+	dup3_type original_dup3 = ORIGINAL(dup3);
+	int fd = original_dup3(oldfd, newfd, flags);
+
+	if (fd != -1)
 	{
-		if (!original_semget)
-			original_semget = (semget_type)dlsym(RTLD_NEXT, "semget");
+		fu53_fd_dup(oldfd, fd);
+		fu53_canon_forget(fd);
+	}
 
-		if (calls < num || num == 0)
-		{
-			calls++;
-			return (original_semget(key, nsems, semflg));
-		}
+	return fd;
+}
+
+int EXPORT(close)(int fd)
+{
+	PROFILE(close);
+
+	close_type original_close = ORIGINAL(close);
+
+	fu53_fd_forget(fd);
+	fu53_canon_forget(fd);
+	COUNT(close, ALLOWED);
+	return (original_close(fd));
+}
+
+int EXPORT(close_range)(unsigned int first, unsigned int last, int flags)
+{
+	PROFILE(close_range);
+
+	close_range_type original_close_range = ORIGINAL(close_range);
+
+	if (!(flags & CLOSE_RANGE_CLOEXEC))
+		fu53_fd_forget_range(first, last);
+	COUNT(close_range, ALLOWED);
+	return (original_close_range(first, last, flags));
+}
+
+void EXPORT(closefrom)(int lowfd)
+{
+	PROFILE(closefrom);
+
+	closefrom_type original_closefrom = ORIGINAL(closefrom);
+
+	if (lowfd >= 0)
+		fu53_fd_forget_range(lowfd, ~0u);
+	COUNT(closefrom, ALLOWED);
+	original_closefrom(lowfd);
+}
+
+int EXPORT(closedir)(DIR *dirp)
+{
+	PROFILE(closedir);
+
+	closedir_type original_closedir = ORIGINAL(closedir);
+
+	fu53_canon_forget(dirfd(dirp));
+	COUNT(closedir, ALLOWED);
+	return (original_closedir(dirp));
+}
+
+int EXPORT(chdir)(const char *path)
+{
+	PROFILE(chdir);
+
+	chdir_type original_chdir = ORIGINAL(chdir);
+	int ret;
+
+	COUNT(chdir, ALLOWED);
+	ret = original_chdir(path);
+
+	if (!ret)
+		fu53_canon_chdir();
+	return ret;
+}
+
+int EXPORT(fchdir)(int fd)
+{
+	PROFILE(fchdir);
+
+	fchdir_type original_fchdir = ORIGINAL(fchdir);
+	int ret;
+
+	COUNT(fchdir, ALLOWED);
+	ret = original_fchdir(fd);
+
+	if (!ret)
+		fu53_canon_chdir();
+	return ret;
+}
+
+int EXPORT(fclose)(FILE *stream)
+{
+	PROFILE(fclose);
+
+	int fd;
+
+	if (fu53_null_release(stream))
+	{
+		COUNT(fclose, REDIRECTED);
+		return 0;
 	}
 
+	fd = fileno(stream);
+	fu53_fd_forget(fd);
+	fu53_canon_forget(fd);
+	COUNT(fclose, ALLOWED);
+	return (ORIGINAL(fclose)(stream));
+}
+
+/* Largest count of one write, which kernel makes.
+ */
+#define MAX_RW_COUNT (INT_MAX & ~4095)
+
+/* Returns count of bytes, which write of count bytes to /dev/null
+ * returns.
+ */
+static inline ssize_t discard(size_t count)
+{
+	return (count < MAX_RW_COUNT ? count : MAX_RW_COUNT);
+}
+
+/* Checks, that writes to descriptor are counted against
+ * FU53_WRITE_BYTES.
+ */
+static inline int metered_fd(int fd)
+{
+	return (fu53_policy.writes && fu53_fd_metered(fd));
+}
+
+/* Returns bytes, which write didn't make, to budget.
+ */
+static inline ssize_t refund(size_t granted, ssize_t ret)
+{
+	fu53_write_give(ret > 0 ? granted - ret : granted);
+	return ret;
+}
+
+/* Returns result of write over budget of bytes.
+ */
+static ssize_t spent(enum fu53_function id, size_t count)
+{
+	if (overspent(id))
+		return discard(count);
+
+	errno = ENOSPC;
 	return -1;
 }
 
-int pipe(int pipefd[2])
+/* Returns total length of vector, or -1, when it's invalid.
+ */
+static inline ssize_t total(const struct iovec *iov, int iovcnt)
+{
+	size_t count = 0;
+
+	if (iovcnt < 0 || iovcnt > IOV_MAX)
+		return -1;
+
+	for (int i = 0; i < iovcnt; i++)
+	{
+		if (iov[i].iov_len > SSIZE_MAX - count)
+			return -1;
+		count += iov[i].iov_len;
+	}
+
+	return count;
+}
+
+ssize_t EXPORT(write)(int fd, const void *buf, size_t count)
 {
-	static pipe_type original_pipe = NULL;
-	static char *value;
-	static char init = 0;
-	static long unsigned num = 0;
-	static int calls = 0;
-	if (!init)
+	PROFILE(write);
+
+	size_t granted;
+
+	if (fu53_fd_class(fd) == FU53_FD_SINK)
 	{
-		value = getenv("WITH_PARALLEL");
-		if (value)
-			num = strtoul(value, NULL, 10);
-		init = 1;
+		COUNT(write, REDIRECTED);
+		return discard(count);
 	}
 
-	if (value)
+	if (metered_fd(fd))
 	{
-		if (!original_pipe)
-			original_pipe = (pipe_type)dlsym(RTLD_NEXT, "pipe");
-		
-		if (calls < num || num == 0)
-		{
-			calls++;
-			return (original_pipe(pipefd));
-		}
+		granted = fu53_write_take(count);
+		if (!granted && count)
+			return spent(FU53_FN_write, count);
+
+		COUNT(write, ALLOWED);
+		return refund(granted, ORIGINAL(write)(fd, buf, granted));
 	}
 
-	return -1;
+	COUNT(write, ALLOWED);
+	return (ORIGINAL(write)(fd, buf, count));
 }
 
-int dup(int oldfd)
+/* Vector is written whole or isn't written at all,
+ * when budget can't take it.
+ */
+ssize_t EXPORT(writev)(int fd, const struct iovec *iov, int iovcnt)
 {
-	static char *value;
-	static char init = 0;
-	if (!init)
+	PROFILE(writev);
+
+	ssize_t count;
+	size_t granted;
+
+	if (fu53_fd_class(fd) == FU53_FD_SINK)
 	{
-		value = getenv("WITH_DUP");
-		init = 1;
+		COUNT(writev, REDIRECTED);
+
+		count = total(iov, iovcnt);
+		if (count == -1)
+			errno = EINVAL;
+		return (count == -1 ? -1 : discard(count));
 	}
 
-	if (!value)
-		return -1;
+	if (metered_fd(fd) && (count = total(iov, iovcnt)) > 0)
+	{
+		granted = fu53_write_take(count);
+		if (granted < (size_t)count)
+		{
+			fu53_write_give(granted);
+			return spent(FU53_FN_writev, count);
+		}
 
-	static dup_type original_dup = NULL;
-	if (!original_dup)
-		original_dup = (dup_type)dlsym(RTLD_NEXT, "dup");
+		COUNT(writev, ALLOWED);
+		return refund(granted, ORIGINAL(writev)(fd, iov, iovcnt));
+	}
 
-	return (original_dup(oldfd));
+	COUNT(writev, ALLOWED);
+	return (ORIGINAL(writev)(fd, iov, iovcnt));
 }
 
-int dup2(int oldfd, int newfd)
+ssize_t EXPORT(pwrite)(int fd, const void *buf, size_t count, off_t offset)
 {
-	static char *value;
-	static char init = 0;
-	if (!init)
+	PROFILE(pwrite);
+
+	size_t granted;
+
+	if (fu53_fd_class(fd) == FU53_FD_SINK)
 	{
-		value = getenv("WITH_DUP");
-		init = 1;
+		COUNT(pwrite, REDIRECTED);
+
+		if (offset < 0)
+		{
+			errno = EINVAL;
+			return -1;
+		}
+
+		return discard(count);
 	}
 
-	if (!value)
-		return -1;
+	if (metered_fd(fd))
+	{
+		granted = fu53_write_take(count);
+		if (!granted && count)
+			return spent(FU53_FN_pwrite, count);
 
-	static dup2_type original_dup2 = NULL;
-	if (!original_dup2)
-		original_dup2 = (dup2_type)dlsym(RTLD_NEXT, "dup2");
+		COUNT(pwrite, ALLOWED);
+		return refund(granted, ORIGINAL(pwrite)(fd, buf, granted, offset));
+	}
 
-	return (original_dup2(oldfd, newfd));
+	COUNT(pwrite, ALLOWED);
+	return (ORIGINAL(pwrite)(fd, buf, count, offset));
 }
 
-int dup3(int oldfd, int newfd, int flags)
+ssize_t EXPORT(pwrite64)(int fd, const void *buf, size_t count, off64_t offset)
 {
-	static char *value;
-	static char init = 0;
-	if (!init)
+	PROFILE(pwrite64);
+
+	size_t granted;
+
+	if (fu53_fd_class(fd) == FU53_FD_SINK)
 	{
-		value = getenv("WITH_DUP");
-		init = 1;
+		COUNT(pwrite64, REDIRECTED);
+
+		if (offset < 0)
+		{
+			errno = EINVAL;
+			return -1;
+		}
+
+		return discard(count);
 	}
 
-	if (!value)
-		return -1;
+	if (metered_fd(fd))
+	{
+		granted = fu53_write_take(count);
+		if (!granted && count)
+			return spent(FU53_FN_pwrite64, count);
 
-	static dup3_type original_dup3 = NULL;
-	if (!original_dup3)
-		original_dup3 = (dup3_type)dlsym(RTLD_NEXT, "dup3");
+		COUNT(pwrite64, ALLOWED);
+		return refund(granted, ORIGINAL(pwrite64)(fd, buf, granted, offset));
+	}
+
+	COUNT(pwrite64, ALLOWED);
+	return (ORIGINAL(pwrite64)(fd, buf, count, offset));
+}
 
-	return (original_dup3(oldfd, newfd, flags));
+/* Returns result of copy over budget of bytes. Copy is failed
+ * with EINVAL instead of discarding, because caller expects input
+ * to advance, and falls back to write(), which is discarded.
+ */
+static ssize_t spent_copy(enum fu53_function id)
+{
+	errno = (overspent(id) ? EINVAL : ENOSPC);
+	return -1;
 }
 
-int setenv(const char *name, const char *value, int overwrite)
+/* Copy from real file to sink still reads file, so only copy from
+ * sink, which is at end of file, is made by library.
+ */
+ssize_t EXPORT(sendfile)(int out_fd, int in_fd, off_t *offset, size_t count)
 {
-	static char *env_value;
-	static char init = 0;
-	if (!init)
+	PROFILE(sendfile);
+
+	size_t granted;
+
+	if (fu53_fd_class(out_fd) == FU53_FD_SINK && fu53_fd_class(in_fd) == FU53_FD_SINK)
 	{
-		env_value = getenv("WITH_ENV");
-		init = 1;
+		COUNT(sendfile, REDIRECTED);
+		return 0;
 	}
 
-	if (!env_value)
-		return -1;
+	if (metered_fd(out_fd))
+	{
+		granted = fu53_write_take(count);
+		if (!granted && count)
+			return spent_copy(FU53_FN_sendfile);
 
-	static setenv_type original_setenv = NULL;
-	if (!original_setenv)
-		original_setenv = (setenv_type)dlsym(RTLD_NEXT, "setenv");
+		COUNT(sendfile, ALLOWED);
+		return refund(granted, ORIGINAL(sendfile)(out_fd, in_fd, offset, granted));
+	}
 
-	return (original_setenv(name, env_value, overwrite));
+	COUNT(sendfile, ALLOWED);
+	return (ORIGINAL(sendfile)(out_fd, in_fd, offset, count));
 }
 
-int unsetenv(const char *name)
+ssize_t EXPORT(sendfile64)(int out_fd, int in_fd, off64_t *offset, size_t count)
 {
-	static char *value;
-	static char init = 0;
-	if (!init)
+	PROFILE(sendfile64);
+
+	size_t granted;
+
+	if (fu53_fd_class(out_fd) == FU53_FD_SINK && fu53_fd_class(in_fd) == FU53_FD_SINK)
 	{
-		value = getenv("WITH_ENV");
-		init = 1;
+		COUNT(sendfile64, REDIRECTED);
+		return 0;
 	}
 
-	if (!value)
-		return -1;
+	if (metered_fd(out_fd))
+	{
+		granted = fu53_write_take(count);
+		if (!granted && count)
+			return spent_copy(FU53_FN_sendfile64);
 
-	static unsetenv_type original_unsetenv = NULL;
-	if (!original_unsetenv)
-		original_unsetenv = (unsetenv_type)dlsym(RTLD_NEXT, "unsetenv");
+		COUNT(sendfile64, ALLOWED);
+		return refund(granted, ORIGINAL(sendfile64)(out_fd, in_fd, offset, granted));
+	}
 
-	return (original_unsetenv(name));
+	COUNT(sendfile64, ALLOWED);
+	return (ORIGINAL(sendfile64)(out_fd, in_fd, offset, count));
 }
 
-int unshare(int flags)
+ssize_t EXPORT(copy_file_range)(int fd_in, off64_t *off_in, int fd_out, off64_t *off_out, size_t len, unsigned int flags)
 {
-	static char *value;
-	static char init = 0;
-	if (!init)
+	PROFILE(copy_file_range);
+
+	size_t granted;
+
+	/* kernel copies regular files only, caller falls back to write() */
+	if (fu53_fd_class(fd_in) == FU53_FD_SINK || fu53_fd_class(fd_out) == FU53_FD_SINK)
 	{
-		value = getenv("WITH_UNSHARE");
-		init = 1;
+		COUNT(copy_file_range, REDIRECTED);
+		errno = EINVAL;
+		return -1;
 	}
 
-	if (!value)
-		return -1;
+	if (metered_fd(fd_out))
+	{
+		granted = fu53_write_take(len);
+		if (!granted && len)
+			return spent_copy(FU53_FN_copy_file_range);
+
+		COUNT(copy_file_range, ALLOWED);
+		return refund(granted, ORIGINAL(copy_file_range)(fd_in, off_in, fd_out, off_out, granted, flags));
+	}
 
-	static unshare_type original_unshare = NULL;
-	if (!original_unshare)
-		original_unshare = (unshare_type)dlsym(RTLD_NEXT, "unshare");
+	COUNT(copy_file_range, ALLOWED);
+	return (ORIGINAL(copy_file_range)(fd_in, off_in, fd_out, off_out, len, flags));
+}
+
+/* Checks, that writable shared mapping of descriptor would write file
+ * past policy. Wrappers record it in map of descriptors at open time:
+ * write-mode opens, which policy blocks, get sink or shadow, so only
+ * metered descriptors are real and writable, and writes of their
+ * mappings can't be counted against FU53_WRITE_BYTES. Descriptors,
+ * which wrappers didn't open (memfd, shm, inherited ones), and mappings
+ * without PROT_WRITE are left alone.
+ */
+static inline int protected(int fd, int prot)
+{
+	return ((prot & PROT_WRITE) && metered_fd(fd));
+}
 
-	return (original_unshare(flags));
+/* Returns flags of private mapping instead of shared one.
+ */
+static inline int private(int flags)
+{
+#ifdef MAP_SYNC
+	flags &= ~MAP_SYNC;
+#endif
+	return ((flags & ~MAP_TYPE) | MAP_PRIVATE);
 }
 
-int mount(const char *source, const char *target, const char *filesystemtype, unsigned long mountflags, const void *data)
+/* Checks, that mapping is shared mapping of file.
+ */
+#define SHARED_FILE(flags) (((flags) & MAP_TYPE) != MAP_PRIVATE && !((flags) & MAP_ANONYMOUS))
+
+void *EXPORT(mmap)(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
 {
-	static char *value;
-	static char init = 0;
-	if (!init)
+	PROFILE(mmap);
+
+	if (SHARED_FILE(flags) && protected(fd, prot))
 	{
-		value = getenv("WITH_MOUNT");
-		init = 1;
+		COUNT(mmap, REDIRECTED);
+		return (ORIGINAL(mmap)(addr, length, prot, private(flags), fd, offset));
 	}
 
-	if (!value)
-		return -1;
+	COUNT(mmap, ALLOWED);
+	return (ORIGINAL(mmap)(addr, length, prot, flags, fd, offset));
+}
 
-	static mount_type original_mount = NULL;
-	if (!original_mount)
-		original_mount = (mount_type)dlsym(RTLD_NEXT, "mount");
+void *EXPORT(mmap64)(void *addr, size_t length, int prot, int flags, int fd, off64_t offset)
+{
+	PROFILE(mmap64);
+
+	if (SHARED_FILE(flags) && protected(fd, prot))
+	{
+		COUNT(mmap64, REDIRECTED);
+		return (ORIGINAL(mmap64)(addr, length, prot, private(flags), fd, offset));
+	}
 
-	return (original_mount(source, target, filesystemtype, mountflags, data));
+	COUNT(mmap64, ALLOWED);
+	return (ORIGINAL(mmap64)(addr, length, prot, flags, fd, offset));
 }
@@ -12,53 +12,929 @@
 #include <assert.h>
 #include <sched.h>
 #include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/uio.h>
 
-typedef int (*open_type)(const char *pathname, int flags, ...);
-typedef int (*open64_type)(const char *pathname, int flags, ...);
-typedef int (*openat_type)(int dirfd, const char *pathname, int flags, ...);
-typedef int (*creat_type)(const char *pathname, mode_t mode);
-typedef void *(*dlopen_type)(const char *, int);
-typedef FILE *(*fopen_type)(const char *pathname, const char *mode);
-typedef FILE *(*fopen64_type)(const char *pathname, const char *mode);
-typedef FILE *(*fdopen_type)(int fildes, const char *mode);
-typedef FILE *(*freopen_type)(const char *pathname, const char *mode, FILE *stream);
-typedef int (*remove_type)(const char *pathname);
-typedef int (*rmdir_type)(const char *pathname);
-typedef int (*unlink_type)(const char *pathname);
-typedef int (*unlinkat_type)(int dirfd, const char *pathname, int flags);
-typedef int (*execv_type)(const char *path, char *const argv[]);
-typedef int (*execve_type)(const char *path, char *const argv[], char *const envp[]);
-typedef int (*execvp_type)(const char *file, char *const argv[]);
-typedef int (*execvpe_type)(const char *file, char *const argv[], char *const envp[]);
-typedef int (*execveat_type)(int dirfd, const char *pathname, char *const argv[], char *const envp[], int flags);
-typedef int (*fexecve_type)(int fd, char *const argv[], char *const envp[]);
-typedef int (*rename_type)(const char *oldpath, const char *newpath);
-typedef int (*renameat_type)(int olddirfd, const char *oldpath, int newdirfd, const char *newpath);
-typedef int (*renameat2_type)(int olddirfd, const char *oldpath, int newdirfd, const char *newpath, unsigned int flags);
-typedef int (*chown_type)(const char *path, uid_t owner, gid_t group);
-typedef int (*fchownat_type)(int dirfd, const char *pathname, uid_t owner, gid_t group, int flags);
-typedef int (*chmod_type)(const char *pathname, mode_t mode);
-typedef int (*fchmodat_type)(int dirfd, const char *pathname, mode_t mode, int flags);
-typedef int (*system_type)(const char *command);
-typedef long (*syscall_type)(long number, ...);
-typedef int (*chroot_type)(const char *path);
-typedef pid_t (*fork_type)(void);
-typedef FILE *(*popen_type)(const char *command, const char *type);
-typedef int (*mkfifo_type)(const char *pathname, mode_t mode);
-typedef int (*mkfifoat_type)(int dirfd, const char *pathname, mode_t mode);
-typedef int (*mknod_type)(const char *pathname, mode_t mode, dev_t dev);
-typedef int (*mknodat_type)(int dirfd, const char *pathname, mode_t mode, dev_t dev);
-typedef sem_t *(*sem_open_type)(const char *name, int oflag, ...);
-typedef int (*semctl_type)(int semid, int semnum, int cmd, ...);
-typedef int (*semget_type)(key_t key, int nsems, int semflg);
-typedef int (*pipe_type)(int pipefd[2]);
-typedef int (*dup_type)(int oldfd);
-typedef int (*dup2_type)(int oldfd, int newfd);
-typedef int (*dup3_type)(int oldfd, int newfd, int flags);
-typedef int (*setenv_type)(const char *name, const char *value, int overwrite);
-typedef int (*unsetenv_type)(const char *name);
-typedef int (*unshare_type)(int flags);
-typedef int (*mount_type)(const char *source, const char *target, const char *filesystemtype, unsigned long mountflags, const void *data);
+/* Table of all functions, which originals are called by wrappers:
+ * X(name, return type, parameters, arguments, category, value of
+ * blocked call, check, paths of check). execl(), execlp() and execle()
+ * are missed, because they call wrappers of other exec functions.
+ *
+ * Wrappers of functions with check other than CUSTOM are generated
+ * from table (see fu53.c):
+ * - ENABLED calls original function, when category is enabled;
+ * - BUDGET calls it, when category is enabled and has budget left;
+ * - PATH and PAIR call it, when path rules allow operation on one or
+ *   two paths (operation, dirfd, path, ...), otherwise follow category.
+ * Functions without category have FU53_CATEGORIES.
+ */
+#define FU53_FUNCTIONS(X) \
+	X(open, int, (const char *pathname, int flags, ...), (), FU53_OPEN, -1, CUSTOM, ()) \
+	X(open64, int, (const char *pathname, int flags, ...), (), FU53_OPEN, -1, CUSTOM, ()) \
+	X(openat, int, (int dirfd, const char *pathname, int flags, ...), (), FU53_OPEN, -1, CUSTOM, ()) \
+	X(creat, int, (const char *pathname, mode_t mode), (pathname, mode), FU53_OPEN, -1, CUSTOM, ()) \
+	X(dlopen, void *, (const char *filename, int flag), (filename, flag), FU53_OPEN, NULL, BUDGET, ()) \
+	X(fopen, FILE *, (const char *pathname, const char *mode), (pathname, mode), FU53_OPEN, NULL, CUSTOM, ()) \
+	X(fopen64, FILE *, (const char *pathname, const char *mode), (pathname, mode), FU53_OPEN, NULL, CUSTOM, ()) \
+	X(fdopen, FILE *, (int fildes, const char *mode), (fildes, mode), FU53_OPEN, NULL, CUSTOM, ()) \
+	X(freopen, FILE *, (const char *pathname, const char *mode, FILE *stream), (pathname, mode, stream), FU53_OPEN, NULL, CUSTOM, ()) \
+	X(remove, int, (const char *pathname), (pathname), FU53_REMOVE, -1, PATH, (FU53_OP_REMOVE, AT_FDCWD, pathname)) \
+	X(rmdir, int, (const char *pathname), (pathname), FU53_REMOVE, -1, PATH, (FU53_OP_REMOVE, AT_FDCWD, pathname)) \
+	X(unlink, int, (const char *pathname), (pathname), FU53_REMOVE, -1, PATH, (FU53_OP_REMOVE, AT_FDCWD, pathname)) \
+	X(unlinkat, int, (int dirfd, const char *pathname, int flags), (dirfd, pathname, flags), FU53_REMOVE, -1, PATH, (FU53_OP_REMOVE, dirfd, pathname)) \
+	X(execv, int, (const char *path, char *const argv[]), (path, argv), FU53_EXEC, -1, ENABLED, ()) \
+	X(execve, int, (const char *path, char *const argv[], char *const envp[]), (path, argv, envp), FU53_EXEC, -1, ENABLED, ()) \
+	X(execvp, int, (const char *file, char *const argv[]), (file, argv), FU53_EXEC, -1, ENABLED, ()) \
+	X(execvpe, int, (const char *file, char *const argv[], char *const envp[]), (file, argv, envp), FU53_EXEC, -1, ENABLED, ()) \
+	X(execveat, int, (int dirfd, const char *pathname, char *const argv[], char *const envp[], int flags), (dirfd, pathname, argv, envp, flags), FU53_EXEC, -1, ENABLED, ()) \
+	X(fexecve, int, (int fd, char *const argv[], char *const envp[]), (fd, argv, envp), FU53_EXEC, -1, ENABLED, ()) \
+	X(rename, int, (const char *oldpath, const char *newpath), (oldpath, newpath), FU53_RENAME, -1, PAIR, (FU53_OP_RENAME, AT_FDCWD, oldpath, AT_FDCWD, newpath)) \
+	X(renameat, int, (int olddirfd, const char *oldpath, int newdirfd, const char *newpath), (olddirfd, oldpath, newdirfd, newpath), FU53_RENAME, -1, PAIR, (FU53_OP_RENAME, olddirfd, oldpath, newdirfd, newpath)) \
+	X(renameat2, int, (int olddirfd, const char *oldpath, int newdirfd, const char *newpath, unsigned int flags), (olddirfd, oldpath, newdirfd, newpath, flags), FU53_RENAME, -1, PAIR, (FU53_OP_RENAME, olddirfd, oldpath, newdirfd, newpath)) \
+	X(chown, int, (const char *path, uid_t owner, gid_t group), (path, owner, group), FU53_CHANGE, -1, PATH, (FU53_OP_CHANGE, AT_FDCWD, path)) \
+	X(fchownat, int, (int dirfd, const char *pathname, uid_t owner, gid_t group, int flags), (dirfd, pathname, owner, group, flags), FU53_CHANGE, -1, PATH, (FU53_OP_CHANGE, dirfd, pathname)) \
+	X(chmod, int, (const char *pathname, mode_t mode), (pathname, mode), FU53_CHANGE, -1, PATH, (FU53_OP_CHANGE, AT_FDCWD, pathname)) \
+	X(fchmodat, int, (int dirfd, const char *pathname, mode_t mode, int flags), (dirfd, pathname, mode, flags), FU53_CHANGE, -1, PATH, (FU53_OP_CHANGE, dirfd, pathname)) \
+	X(system, int, (const char *command), (command), FU53_SYSTEM, -1, ENABLED, ()) \
+	X(syscall, long, (long number, ...), (), FU53_SYSTEM, -1, CUSTOM, ()) \
+	X(chroot, int, (const char *path), (path), FU53_SYSTEM, -1, ENABLED, ()) \
+	X(fork, pid_t, (void), (), FU53_FORK, -1, BUDGET, ()) \
+	X(popen, FILE *, (const char *command, const char *type), (command, type), FU53_PARALLEL, NULL, BUDGET, ()) \
+	X(mkfifo, int, (const char *pathname, mode_t mode), (pathname, mode), FU53_PARALLEL, -1, CUSTOM, ()) \
+	X(mkfifoat, int, (int dirfd, const char *pathname, mode_t mode), (dirfd, pathname, mode), FU53_PARALLEL, -1, CUSTOM, ()) \
+	X(mknod, int, (const char *pathname, mode_t mode, dev_t dev), (pathname, mode, dev), FU53_PARALLEL, -1, CUSTOM, ()) \
+	X(mknodat, int, (int dirfd, const char *pathname, mode_t mode, dev_t dev), (dirfd, pathname, mode, dev), FU53_PARALLEL, -1, CUSTOM, ()) \
+	X(sem_open, sem_t *, (const char *name, int oflag, ...), (), FU53_PARALLEL, SEM_FAILED, CUSTOM, ()) \
+	X(semctl, int, (int semid, int semnum, int cmd, ...), (), FU53_PARALLEL, -1, CUSTOM, ()) \
+	X(semget, int, (key_t key, int nsems, int semflg), (key, nsems, semflg), FU53_PARALLEL, -1, BUDGET, ()) \
+	X(pipe, int, (int pipefd[2]), (pipefd), FU53_PARALLEL, -1, BUDGET, ()) \
+	X(dup, int, (int oldfd), (oldfd), FU53_DUP, -1, CUSTOM, ()) \
+	X(dup2, int, (int oldfd, int newfd), (oldfd, newfd), FU53_DUP, -1, CUSTOM, ()) \
+	X(dup3, int, (int oldfd, int newfd, int flags), (oldfd, newfd, flags), FU53_DUP, -1, CUSTOM, ()) \
+	X(setenv, int, (const char *name, const char *value, int overwrite), (name, value, overwrite), FU53_ENV, -1, ENABLED, ()) \
+	X(unsetenv, int, (const char *name), (name), FU53_ENV, -1, ENABLED, ()) \
+	X(unshare, int, (int flags), (flags), FU53_UNSHARE, -1, ENABLED, ()) \
+	X(mount, int, (const char *source, const char *target, const char *filesystemtype, unsigned long mountflags, const void *data), (source, target, filesystemtype, mountflags, data), FU53_MOUNT, -1, ENABLED, ()) \
+	X(close, int, (int fd), (fd), FU53_CATEGORIES, -1, CUSTOM, ()) \
+	X(close_range, int, (unsigned int first, unsigned int last, int flags), (first, last, flags), FU53_CATEGORIES, -1, CUSTOM, ()) \
+	X(closefrom, void, (int lowfd), (lowfd), FU53_CATEGORIES, , CUSTOM, ()) \
+	X(closedir, int, (DIR *dirp), (dirp), FU53_CATEGORIES, -1, CUSTOM, ()) \
+	X(chdir, int, (const char *path), (path), FU53_CATEGORIES, -1, CUSTOM, ()) \
+	X(fchdir, int, (int fd), (fd), FU53_CATEGORIES, -1, CUSTOM, ()) \
+	X(fclose, int, (FILE *stream), (stream), FU53_CATEGORIES, EOF, CUSTOM, ()) \
+	X(write, ssize_t, (int fd, const void *buf, size_t count), (fd, buf, count), FU53_CATEGORIES, -1, CUSTOM, ()) \
+	X(writev, ssize_t, (int fd, const struct iovec *iov, int iovcnt), (fd, iov, iovcnt), FU53_CATEGORIES, -1, CUSTOM, ()) \
+	X(pwrite, ssize_t, (int fd, const void *buf, size_t count, off_t offset), (fd, buf, count, offset), FU53_CATEGORIES, -1, CUSTOM, ()) \
+	X(pwrite64, ssize_t, (int fd, const void *buf, size_t count, off64_t offset), (fd, buf, count, offset), FU53_CATEGORIES, -1, CUSTOM, ()) \
+	X(sendfile, ssize_t, (int out_fd, int in_fd, off_t *offset, size_t count), (out_fd, in_fd, offset, count), FU53_CATEGORIES, -1, CUSTOM, ()) \
+	X(sendfile64, ssize_t, (int out_fd, int in_fd, off64_t *offset, size_t count), (out_fd, in_fd, offset, count), FU53_CATEGORIES, -1, CUSTOM, ()) \
+	X(copy_file_range, ssize_t, (int fd_in, off64_t *off_in, int fd_out, off64_t *off_out, size_t len, unsigned int flags), (fd_in, off_in, fd_out, off_out, len, flags), FU53_CATEGORIES, -1, CUSTOM, ()) \
+	X(mmap, void *, (void *addr, size_t length, int prot, int flags, int fd, off_t offset), (addr, length, prot, flags, fd, offset), FU53_CATEGORIES, MAP_FAILED, CUSTOM, ()) \
+	X(mmap64, void *, (void *addr, size_t length, int prot, int flags, int fd, off64_t offset), (addr, length, prot, flags, fd, offset), FU53_CATEGORIES, MAP_FAILED, CUSTOM, ())
+
+/* Types of original functions.
+ */
+#define X(name, ret, params, ...) typedef ret (*name##_type) params;
+FU53_FUNCTIONS(X)
+#undef X
+
+/* Identifiers of functions in table of original functions.
+ */
+enum fu53_function
+{
+#define X(name, ...) FU53_FN_##name,
+	FU53_FUNCTIONS(X)
+#undef X
+	FU53_FUNCTIONS_COUNT
+};
+
+#ifdef FU53_WRAP
+/* Library, built by make wrap, is linked into target with ld --wrap
+ * option for every function (see fu53.wrap): wrappers are named
+ * __wrap_<function>, and linker binds __real_<function> to original
+ * one, so static binaries have neither table nor indirect calls.
+ */
+#define EXPORT(name) __wrap_##name
+
+#define X(name, ret, params, ...) ret __real_##name params;
+FU53_FUNCTIONS(X)
+#undef X
+
+#define ORIGINAL(name) (__real_##name)
+#else
+#define EXPORT(name) name
+
+/* Table of original functions.
+ * It's filled by library constructor, so forkserver children
+ * never resolve symbols by themselves.
+ */
+extern void *fu53_originals[FU53_FUNCTIONS_COUNT];
+
+/* Table of fallbacks, which are used, when original function
+ * can't be resolved, e.g. in static binaries or on early calls.
+ * Fallbacks make raw system calls or fail with ENOSYS.
+ */
+extern void *const fu53_fallbacks[FU53_FUNCTIONS_COUNT];
+
+/* Resolves all original functions in one pass.
+ * Returns resolved function or fallback for id.
+ */
+void *fu53_resolve(enum fu53_function id);
+
+/* Returns original function, or fallback when it can't be resolved.
+ */
+static inline void *fu53_original(enum fu53_function id)
+{
+	void *function = fu53_originals[id];
+
+	if (__builtin_expect(!function, 0))
+		function = fu53_resolve(id);
+
+	return function;
+}
+
+#define ORIGINAL(name) ((name##_type)fu53_original(FU53_FN_##name))
+#endif
+
+/* Makes system call with raw syscall instruction.
+ * Returns -errno on error and doesn't touch errno, so it can be
+ * used before libc is initialized.
+ */
+static inline long fu53_raw(long number, long a0, long a1, long a2, long a3, long a4, long a5)
+{
+	long ret;
+#if defined(__x86_64__)
+	register long r10 __asm__("r10") = a3;
+	register long r8 __asm__("r8") = a4;
+	register long r9 __asm__("r9") = a5;
+	__asm__ volatile("syscall"
+					 : "=a"(ret)
+					 : "a"(number), "D"(a0), "S"(a1), "d"(a2), "r"(r10), "r"(r8), "r"(r9)
+					 : "rcx", "r11", "memory");
+#elif defined(__aarch64__)
+	register long x8 __asm__("x8") = number;
+	register long x0 __asm__("x0") = a0;
+	register long x1 __asm__("x1") = a1;
+	register long x2 __asm__("x2") = a2;
+	register long x3 __asm__("x3") = a3;
+	register long x4 __asm__("x4") = a4;
+	register long x5 __asm__("x5") = a5;
+	__asm__ volatile("svc 0"
+					 : "+r"(x0)
+					 : "r"(x8), "r"(x1), "r"(x2), "r"(x3), "r"(x4), "r"(x5)
+					 : "memory");
+	ret = x0;
+#else
+	(void)number, (void)a0, (void)a1, (void)a2, (void)a3, (void)a4, (void)a5;
+	ret = -ENOSYS;
+#endif
+	return ret;
+}
+
+/* Makes system call with raw syscall instruction.
+ * Sets errno and returns -1 on error, like syscall() does.
+ */
+long fu53_raw_syscall(long number, long a0, long a1, long a2, long a3, long a4, long a5);
+
+/* Flags of open(), which can modify file.
+ */
+#define WRITE_FLAGS (O_CREAT | O_APPEND | O_WRONLY | O_RDWR | O_SYNC)
+
+/* Checks, that open() flags require mode argument.
+ */
+#define NEEDS_MODE(flags) ((flags) & O_CREAT || ((flags) & O_TMPFILE) == O_TMPFILE)
+
+/* Checks, that fopen() mode can modify file.
+ */
+static inline int write_mode(const char *mode)
+{
+	return (strchr(mode, 'w') || strchr(mode, 'a') || strchr(mode, '+'));
+}
+
+/* Exported functions jump through pointers, which library constructor
+ * points to specialized implementation or generic wrapper (see
+ * select.c). Baked and static libraries have no pointers.
+ */
+#if !defined(FU53_BAKED) && !defined(FU53_WRAP)
+#define FU53_SELECT
+#endif
+
+/* Name of generic wrapper of function.
+ */
+#ifdef FU53_SELECT
+#define GENERIC(name) fu53_generic_##name
+
+#define X(name, ret, params, ...) ret fu53_generic_##name params __attribute__((visibility("hidden")));
+FU53_FUNCTIONS(X)
+#undef X
+#else
+#define GENERIC(name) EXPORT(name)
+#endif
+
+/* Categories of functions.
+ * Every category is enabled by its own WITH_* variable.
+ */
+enum fu53_category
+{
+	FU53_OPEN,
+	FU53_REMOVE,
+	FU53_EXEC,
+	FU53_RENAME,
+	FU53_CHANGE,
+	FU53_SYSTEM,
+	FU53_FORK,
+	FU53_PARALLEL,
+	FU53_DUP,
+	FU53_ENV,
+	FU53_UNSHARE,
+	FU53_MOUNT,
+	FU53_CATEGORIES
+};
+
+/* Action, which wrappers take on call of category function.
+ */
+enum fu53_action
+{
+	FU53_BLOCK = 0, /* default, stub or /dev/null redirect */
+	FU53_ALLOW,		/* WITH_* is set, original function is used */
+	FU53_CRASH		/* NO_* is set, assert(0) is thrown */
+};
+
+/* Policy of library.
+ * It parses once from environment by library constructor,
+ * and fits in one cache line, so wrappers read it with a single load.
+ * Budgets are kept apart, because only budgeted calls read them.
+ */
+struct fu53_policy
+{
+	unsigned char action[FU53_CATEGORIES];
+	unsigned char coverage;
+	unsigned char quota;	/* FU53_BUDGET=thread */
+	unsigned char shadow;	/* FU53_SHADOW */
+	unsigned char landlock; /* FU53_LANDLOCK, when applied */
+	unsigned char rules;	/* FU53_RULES, when compiled */
+	unsigned char cache;	/* FU53_CACHE, when any file is cached */
+	unsigned char input;	/* FU53_INPUT, when testcase is shared */
+	unsigned char writes;	/* FU53_WRITE_BYTES or FU53_WRITE_FILES */
+} __attribute__((aligned(64)));
+
+_Static_assert(sizeof(struct fu53_policy) <= 64, "policy must fit in one cache line");
+
+extern struct fu53_policy fu53_policy;
+
+/* Budgets of WITH_*=N variables, 0 means unlimited.
+ */
+extern unsigned int fu53_limits[FU53_CATEGORIES];
+
+#ifdef FU53_BAKED
+/* Policy, which is baked into library by make POLICY=<file>.
+ * baked.h is generated from WITH_* and NO_* lines of file,
+ * see Makefile.
+ */
+#include "baked.h"
+
+static const unsigned char fu53_baked_action[FU53_CATEGORIES] = {
+#define X(category, limit) [FU53_##category] = FU53_ALLOW,
+	FU53_BAKED_WITH(X)
+#undef X
+#define X(category) [FU53_##category] = FU53_CRASH,
+	FU53_BAKED_NO(X)
+#undef X
+};
+
+static const unsigned int fu53_baked_limit[FU53_CATEGORIES] = {
+#define X(category, limit) [FU53_##category] = limit,
+	FU53_BAKED_WITH(X)
+#undef X
+};
+
+/* Blocked REMOVE and RENAME are still relaxed by Landlock at runtime.
+ */
+static inline unsigned char fu53_action(enum fu53_category category)
+{
+	if (fu53_baked_action[category] == FU53_BLOCK && (category == FU53_REMOVE || category == FU53_RENAME))
+		return fu53_policy.action[category];
+
+	return fu53_baked_action[category];
+}
+
+#define fu53_limit(category) (fu53_baked_limit[category])
+#else
+#define fu53_action(category) (fu53_policy.action[category])
+#define fu53_limit(category) (fu53_limits[category])
+#endif
+
+/* Options of library, FU53_* variables.
+ * Unlike policy, they are read by constructor and cold paths only.
+ */
+struct fu53_options
+{
+	unsigned int sink_max;		/* FU53_SINK_MAX */
+	unsigned char seccomp;		/* FU53_SECCOMP */
+	unsigned char write_action; /* FU53_WRITE_ACTION */
+	unsigned char generic;		/* FU53_SELECT=0 */
+	unsigned char fd_streams;	/* FU53_NULL_STREAMS=0 */
+	unsigned long write_bytes;	/* FU53_WRITE_BYTES, 0 means unlimited */
+	unsigned long write_files;	/* FU53_WRITE_FILES, 0 means unlimited */
+	const char *landlock;		/* FU53_LANDLOCK */
+	const char *rules;			/* FU53_RULES */
+	const char *cache;			/* FU53_CACHE */
+	const char *input;			/* FU53_INPUT */
+	const char *stats;			/* FU53_STATS */
+	const char *profile;		/* FU53_PROFILE */
+};
+
+extern struct fu53_options fu53_options;
+
+/* Generation of execution context.
+ * It's changed on every reset of library state.
+ */
+extern unsigned long fu53_generation;
+
+/* Calls, which current thread can make without touching global pool,
+ * and generation, which they belong to.
+ */
+extern __thread unsigned int fu53_slabs[FU53_CATEGORIES] __attribute__((tls_model("initial-exec")));
+extern __thread unsigned long fu53_slabs_generation __attribute__((tls_model("initial-exec")));
+
+/* Fills budgets of categories in mask from policy.
+ */
+void fu53_budget_init(unsigned int mask);
+
+/* Takes next slab of calls for current thread.
+ * Returns non-zero, when call can be made.
+ */
+int fu53_refill(enum fu53_category category);
+
+/* Outcomes of calls, counted for every function.
+ * Exhausted calls are counted as blocked or redirected too.
+ */
+enum fu53_outcome
+{
+	FU53_ALLOWED,	 /* passed to original function */
+	FU53_REDIRECTED, /* served by sink, shadow, cache or testcase */
+	FU53_BLOCKED,	 /* failed by policy */
+	FU53_CRASHED,	 /* crashed by NO_* variable */
+	FU53_EXHAUSTED,	 /* WITH_* budget ran out */
+	FU53_OUTCOMES
+};
+
+#define FU53_STATS_MAGIC "fu53stat"
+#define FU53_STATS_VERSION 1
+#define FU53_NAME_LEN 16
+
+/* Counters of one function, one cache line each.
+ */
+struct fu53_counters
+{
+	unsigned long count[FU53_OUTCOMES];
+} __attribute__((aligned(64)));
+
+/* Statistics block, which is mapped at /dev/shm/<FU53_STATS>.
+ * Readers find functions by names and read counters,
+ * while target runs.
+ */
+struct fu53_stats
+{
+	char magic[8];
+	unsigned int version;
+	unsigned int functions;
+	unsigned int outcomes;
+	int pid;
+	char name[FU53_FUNCTIONS_COUNT][FU53_NAME_LEN];
+	struct fu53_counters function[FU53_FUNCTIONS_COUNT];
+};
+
+/* Statistics block of process, static one without FU53_STATS.
+ */
+extern struct fu53_stats *fu53_stats;
+
+#ifdef FU53_PROFILE
+/* Phases of wrapper call, which are timed separately:
+ * library logic and original function.
+ */
+enum fu53_phase
+{
+	FU53_SELF,
+	FU53_LIBC,
+	FU53_PHASES
+};
+
+#define FU53_PROFILE_MAGIC "fu53prof"
+#define FU53_PROFILE_VERSION 1
+
+/* Log-linear histograms: ticks below FU53_LINEAR have own buckets,
+ * every next power of two is split into FU53_STEPS buckets.
+ */
+#define FU53_LINEAR 16
+#define FU53_STEPS 8
+#define FU53_BUCKETS (FU53_LINEAR + 32 * FU53_STEPS)
+
+struct fu53_histogram
+{
+	unsigned long count;
+	unsigned long sum;
+	unsigned long bucket[FU53_BUCKETS];
+};
+
+/* Profile block, which is mapped at /dev/shm/<FU53_PROFILE>.
+ * Readers convert ticks to nanoseconds with ticks and ns,
+ * taken by constructor, and their own pair of them.
+ */
+struct fu53_profile
+{
+	char magic[8];
+	unsigned int version;
+	unsigned int functions;
+	unsigned int buckets;
+	int pid;
+	unsigned long ticks;
+	unsigned long ns;
+	char name[FU53_FUNCTIONS_COUNT][FU53_NAME_LEN];
+	struct fu53_histogram histogram[FU53_FUNCTIONS_COUNT][FU53_PHASES];
+};
+
+/* Wrapper call, which is being timed.
+ * Samples of nested wrappers are linked.
+ */
+struct fu53_sample
+{
+	enum fu53_function id;
+	enum fu53_outcome outcome;
+	unsigned long start;
+	unsigned long mark;
+	struct fu53_sample *outer;
+};
+
+extern __thread struct fu53_sample *fu53_sample __attribute__((tls_model("initial-exec")));
+
+/* Reads cycle counter, or monotonic clock,
+ * when architecture has no counter.
+ */
+static inline unsigned long fu53_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+	unsigned long ticks;
+
+	__asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(ticks));
+	return ticks;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ul + ts.tv_nsec;
+#endif
+}
+
+/* Starts timing of wrapper call.
+ */
+static inline void fu53_profile_enter(struct fu53_sample *sample, enum fu53_function id)
+{
+	sample->id = id;
+	sample->outcome = FU53_OUTCOMES;
+	sample->outer = fu53_sample;
+	fu53_sample = sample;
+	sample->start = fu53_ticks();
+}
+
+/* Marks moment, when wrapper has chosen outcome of call.
+ * Time after last mark belongs to original function,
+ * when call is allowed.
+ */
+static inline void fu53_profile_mark(enum fu53_function id, enum fu53_outcome outcome)
+{
+	struct fu53_sample *sample = fu53_sample;
+
+	if (sample && sample->id == id)
+	{
+		sample->outcome = outcome;
+		sample->mark = fu53_ticks();
+	}
+}
+
+/* Ends timing of wrapper call, cleanup handler of sample.
+ */
+void fu53_profile_exit(struct fu53_sample *sample);
+
+/* Maps profile block at shared memory name,
+ * or prints profile on exit with name "-".
+ * Returns -1, when it can't be mapped.
+ */
+int fu53_profile_init(const char *name);
+#endif
+
+/* Counts outcome of function call.
+ */
+static inline void fu53_count(enum fu53_function id, enum fu53_outcome outcome)
+{
+	__atomic_add_fetch(&fu53_stats->function[id].count[outcome], 1, __ATOMIC_RELAXED);
+#ifdef FU53_PROFILE
+	fu53_profile_mark(id, outcome);
+#endif
+}
+
+/* Counts outcome of call of function name.
+ */
+#define COUNT(name, outcome) fu53_count(FU53_FN_##name, FU53_##outcome)
+
+/* Times call of function name till return of wrapper,
+ * when library is built with FU53_PROFILE (see profile.c).
+ */
+#ifdef FU53_PROFILE
+#define PROFILE(name)                                                        \
+	struct fu53_sample sample __attribute__((cleanup(fu53_profile_exit))); \
+	fu53_profile_enter(&sample, FU53_FN_##name)
+#else
+#define PROFILE(name) (void)0
+#endif
+
+/* Maps statistics block at shared memory name.
+ * Returns -1, when it can't be mapped.
+ */
+int fu53_stats_init(const char *name);
+
+/* Limits of coverage suffixes list.
+ */
+#define FU53_SUFFIXES 8
+#define FU53_SUFFIX_LEN 16
+
+/* Checks, that path ends with one of coverage suffixes,
+ * specified by WITH_COVERAGE.
+ * Every matched path is counted.
+ */
+int fu53_coverage_exempt(const char *pathname);
+
+/* Returns number of opens, which went to original
+ * functions because of coverage exemption.
+ */
+unsigned long fu53_coverage_count(void);
+
+/* Starts new execution context.
+ * Resets budgets of categories in mask in O(1).
+ */
+void fu53_reset(unsigned int mask);
+
+/* Registers handlers, which give every forked child
+ * new execution context.
+ */
+void fu53_context_init(void);
+
+/* Returned by shadow functions, when path has no shadow
+ * and can't get it.
+ */
+#define FU53_SHADOW_NONE -2
+
+/* Opens memfd shadow of file for write-mode open.
+ * Shadow is created and seeded from real file on first open.
+ * Returns new file descriptor, or -1 with errno on error.
+ */
+int fu53_shadow_open(int dirfd, const char *pathname, int flags);
+
+/* Opens existing shadow of file for read-mode open.
+ */
+int fu53_shadow_find(int dirfd, const char *pathname, int flags);
+
+/* Drops all shadows. Child process reinitializes lock,
+ * which could be held by other thread of parent on fork.
+ */
+void fu53_shadow_reset(int child);
+
+/* Number of descriptors, which are tracked by library.
+ */
+#define FU53_FDS 65536
+
+/* Classes of descriptors, which are held by target.
+ */
+enum fu53_fd
+{
+	FU53_FD_REAL,	/* opened by original function, or not tracked */
+	FU53_FD_SINK,	/* duplicate of /dev/null */
+	FU53_FD_SHADOW, /* shadow copy of file */
+	FU53_FD_VIRTUAL /* cached file or testcase */
+};
+
+#define FU53_FDS_PER_WORD (4 * sizeof(unsigned long))
+
+/* Classes of descriptors, two bits per descriptor (see fds.c).
+ */
+extern unsigned long fu53_fds[FU53_FDS / FU53_FDS_PER_WORD];
+
+/* Returns class of descriptor with a single load.
+ */
+static inline enum fu53_fd fu53_fd_class(int fd)
+{
+	if ((unsigned int)fd >= FU53_FDS)
+		return FU53_FD_REAL;
+
+	return (__atomic_load_n(&fu53_fds[fd / FU53_FDS_PER_WORD], __ATOMIC_RELAXED) >> (fd % FU53_FDS_PER_WORD * 2)) & 3;
+}
+
+/* Sets class of descriptor.
+ */
+void fu53_fd_set(int fd, enum fu53_fd class);
+
+/* Forgets class of descriptor, which is closed by target,
+ * or is given to stream, which is closed by fclose() inside libc.
+ */
+void fu53_fd_forget(int fd);
+
+/* Copies class of descriptor on dup*().
+ */
+void fu53_fd_dup(int oldfd, int newfd);
+
+#define FU53_BITS_PER_WORD (8 * sizeof(unsigned long))
+
+/* Descriptors, which writes are counted against FU53_WRITE_BYTES,
+ * one bit per descriptor (see fds.c).
+ */
+extern unsigned long fu53_metered[FU53_FDS / FU53_BITS_PER_WORD];
+
+static inline int fu53_fd_metered(int fd)
+{
+	if ((unsigned int)fd >= FU53_FDS)
+		return 0;
+
+	return (__atomic_load_n(&fu53_metered[fd / FU53_BITS_PER_WORD], __ATOMIC_RELAXED) >> (fd % FU53_BITS_PER_WORD)) & 1;
+}
+
+/* Resets class of descriptor, which original function returned,
+ * because its number could be closed behind library (see sink.c).
+ * Returns fd.
+ */
+static inline int fu53_fd_fresh(int fd)
+{
+	if (fu53_fd_class(fd) != FU53_FD_REAL || fu53_fd_metered(fd))
+		fu53_fd_forget(fd);
+
+	return fd;
+}
+
+/* Forgets descriptors from first to last, which are closed
+ * by close_range(), closefrom() or syscall().
+ */
+void fu53_fd_forget_range(unsigned int first, unsigned int last);
+
+/* Marks descriptor of permitted write-mode open as metered.
+ */
+void fu53_fd_meter(int fd);
+
+/* Actions on writes over budget, FU53_WRITE_ACTION.
+ */
+enum fu53_spent
+{
+	FU53_SPENT_ENOSPC, /* default, call fails with ENOSPC */
+	FU53_SPENT_SINK,   /* open is redirected to /dev/null, write is discarded */
+	FU53_SPENT_CRASH   /* assert(0) is thrown, like with NO_* */
+};
+
+/* Refills budgets of bytes and files of execution.
+ */
+void fu53_writes_reset(void);
+
+/* Takes bytes for write of count bytes to metered descriptor.
+ * Returns count or less, when budget is almost spent,
+ * and 0, when it's spent.
+ */
+size_t fu53_write_take(size_t count);
+
+/* Returns bytes, which weren't written, to budget.
+ */
+void fu53_write_give(size_t count);
+
+/* Takes one file for permitted write-mode open, before it's made.
+ * Returns zero, when budget of files is spent.
+ */
+int fu53_write_file(void);
+
+/* Returns file of open, which failed, to budget.
+ */
+void fu53_write_file_give(void);
+
+/* Opens /dev/null once for every access mode, for redirected write-mode opens.
+ */
+void fu53_sink_init(void);
+
+/* Returns duplicate of /dev/null for redirected open().
+ * Fails with EMFILE, when FU53_SINK_MAX descriptors are held.
+ */
+int fu53_sink_open(int flags);
+
+/* Opens stream over duplicate of /dev/null for redirected stream.
+ * Descriptor isn't tracked, because stream is closed by fclose().
+ * Null stream is returned instead, when pool has one.
+ */
+FILE *fu53_sink_stream(const char *mode);
+
+/* Allocates pool of null streams, unless FU53_NULL_STREAMS=0 is set.
+ */
+void fu53_null_init(void);
+
+/* Takes stream, which discards writes without system calls,
+ * from pool. Returns NULL, when pool is empty.
+ */
+FILE *fu53_null_stream(void);
+
+/* Checks if stream is taken from pool.
+ */
+int fu53_null_owned(FILE *stream);
+
+/* Closes file of stream and returns stream to pool.
+ * Returns zero, when stream isn't from pool.
+ */
+int fu53_null_release(FILE *stream);
+
+/* Reopens null stream for freopen() in place: on /dev/null
+ * it discards writes again, on other paths it's backed by file.
+ */
+FILE *fu53_null_reopen(const char *path, const char *mode, FILE *stream);
+
+/* Converts fopen() mode to open() flags.
+ */
+static inline int fu53_mode_flags(const char *mode)
+{
+	int flags = (strchr(mode, '+') ? O_RDWR : (*mode == 'r' ? O_RDONLY : O_WRONLY));
+
+	if (*mode == 'w')
+		flags |= O_CREAT | O_TRUNC;
+	else if (*mode == 'a')
+		flags |= O_CREAT | O_APPEND;
+
+	if (strchr(mode, 'x'))
+		flags |= O_EXCL;
+	if (strchr(mode, 'e'))
+		flags |= O_CLOEXEC;
+
+	return flags;
+}
+
+/* Counts sink descriptor, which is held by target,
+ * or is released by it.
+ */
+void fu53_sink_hold(void);
+void fu53_sink_release(void);
+
+/* Forgets sink of library, when target closes its descriptor.
+ */
+void fu53_sink_close(int fd);
+void fu53_sink_close_range(unsigned int first, unsigned int last);
+
+/* Checks with fstat(), that descriptor is /dev/null.
+ */
+int fu53_sink_is(int fd);
+
+/* Starts peak of sink descriptors from current number.
+ */
+void fu53_sink_reset(void);
+
+/* Returns number of sink descriptors, which are held by target.
+ * Peak number of current execution is returned in max.
+ */
+unsigned int fu53_sink_count(unsigned int *max);
+
+/* Compiles policy into seccomp filter and installs it.
+ * Returns -1, when filter can't be installed.
+ */
+int fu53_seccomp_init(void);
+
+/* Operations, which path rules are written for.
+ */
+enum fu53_op
+{
+	FU53_OP_READ,
+	FU53_OP_WRITE,
+	FU53_OP_REMOVE,
+	FU53_OP_RENAME,
+	FU53_OP_CHANGE,
+	FU53_OPS
+};
+
+/* Verdicts of path rules.
+ */
+enum fu53_verdict
+{
+	FU53_RULE_NONE = 0,
+	FU53_RULE_ALLOW,
+	FU53_RULE_DENY
+};
+
+/* Loads rules from file and compiles them.
+ * Returns -1 and reports reason on stderr, when rules can't be loaded.
+ */
+int fu53_rules_init(const char *path);
+
+/* Returns verdict of rules for operation on path.
+ * Sets errno to EACCES, when operation is denied.
+ */
+int fu53_rule(enum fu53_op op, const char *pathname);
+
+/* Loads files, matching patterns, into cache.
+ */
+void fu53_cache_init(const char *patterns);
+
+/* Opens cached copy of file for read-mode open.
+ * Returns FU53_SHADOW_NONE, when file isn't cached.
+ */
+int fu53_cache_open(int dirfd, const char *pathname, int flags);
+
+/* Attaches shared memory testcase of fuzzer
+ * and delivers it to virtual path or stdin.
+ */
+void fu53_input_init(const char *value);
+
+/* Opens testcase for read-mode open of virtual path.
+ * Returns FU53_SHADOW_NONE for other paths and without testcase in shared memory.
+ */
+int fu53_input_open(int dirfd, const char *pathname, int flags);
+
+/* Refills testcase for new execution context.
+ */
+void fu53_input_reset(int child);
+
+/* Returns absolute, lexically normal path of pathname,
+ * which is relative to dirfd. Result is pathname itself or
+ * is placed in buf of PATH_MAX bytes.
+ * Returns NULL, when path of dirfd is unknown.
+ */
+const char *fu53_canon(int dirfd, const char *pathname, char *buf);
+
+/* Rereads current directory after its change.
+ */
+void fu53_canon_chdir(void);
+
+/* Drops cached path of closed descriptor.
+ */
+void fu53_canon_forget(int fd);
+
+/* Drops state, which can't be used by child.
+ */
+void fu53_canon_reset(int child);
+
+/* Key of tables, which are keyed by canonical paths (shadows, cache).
+ * Entries of such tables start with key.
+ */
+struct fu53_key
+{
+	unsigned long hash;
+	char *path;
+};
+
+/* FNV-1a hash of path.
+ */
+static inline unsigned long fu53_hash(const char *pathname)
+{
+	unsigned long h = 14695981039346656037ul;
+
+	for (; *pathname; pathname++)
+		h = (h ^ (unsigned char)*pathname) * 1099511628211ul;
+
+	return h;
+}
+
+/* Returns slot of path in table of count entries of size bytes,
+ * or free slot, where path should be placed.
+ * Returns -1, when table is full.
+ */
+static inline int fu53_slot(const void *table, size_t size, unsigned int count, const char *pathname, unsigned long h)
+{
+	for (unsigned int n = 0, i = h % count; n < count; n++, i = (i + 1) % count)
+	{
+		const struct fu53_key *key = (const struct fu53_key *)((const char *)table + i * size);
+
+		if (!key->path)
+			return i;
+
+		if (key->hash == h && !strcmp(key->path, pathname))
+			return i;
+	}
+
+	return -1;
+}
+
+/* Restricts writes to directory root with Landlock ruleset.
+ * Returns -1, when ruleset can't be applied.
+ */
+int fu53_landlock_init(const char *root);
+
+/* Points exported functions to implementations, which policy needs.
+ */
+void fu53_select(void);
+
+/* Library constructor.
+ * Parses all WITH_* and NO_* variables in one pass over environment
+ * and resolves table of original functions.
+ */
+void fu53_init(void);
 
 /* Safe call of original open().
  * To prevent system file modification
@@ -310,3 +1186,82 @@ int unshare(int flags);
 /* Stub for mount() function.
  */
 int mount(const char *source, const char *target, const char *filesystemtype, unsigned long mountflags, const void *data);
+
+/* Wrapper of close() function.
+ * Needs to track descriptors, opened by library.
+ */
+int close(int fd);
+
+/* Wrappers of close_range() and closefrom() functions.
+ * Need to forget descriptors, which are closed by them.
+ */
+int close_range(unsigned int first, unsigned int last, int flags);
+void closefrom(int lowfd);
+
+/* Wrapper of closedir() function.
+ * Needs to drop cached path of directory descriptor.
+ */
+int closedir(DIR *dirp);
+
+/* Wrapper of chdir() function.
+ * Needs to track current directory for relative paths.
+ */
+int chdir(const char *path);
+
+/* Wrapper of fchdir() function.
+ * Needs to track current directory for relative paths.
+ */
+int fchdir(int fd);
+
+/* Wrapper of fclose() function.
+ * Returns null streams to pool and forgets descriptors of others.
+ */
+int fclose(FILE *stream);
+
+/* Wrapper of write() function.
+ * Writes to sink descriptors succeed without system call.
+ */
+ssize_t write(int fd, const void *buf, size_t count);
+
+/* Wrapper of writev() function.
+ * Writes to sink descriptors succeed without system call.
+ */
+ssize_t writev(int fd, const struct iovec *iov, int iovcnt);
+
+/* Wrappers of pwrite() and pwrite64() functions.
+ * Writes to sink descriptors succeed without system call.
+ */
+ssize_t pwrite(int fd, const void *buf, size_t count, off_t offset);
+ssize_t pwrite64(int fd, const void *buf, size_t count, off64_t offset);
+
+/* Wrappers of sendfile() and sendfile64() functions.
+ * Copy from sink to sink returns end of file without system call.
+ */
+ssize_t sendfile(int out_fd, int in_fd, off_t *offset, size_t count);
+ssize_t sendfile64(int out_fd, int in_fd, off64_t *offset, size_t count);
+
+/* Wrapper of copy_file_range() function.
+ * Copy from or to sink fails without system call,
+ * like kernel fails it for /dev/null.
+ */
+ssize_t copy_file_range(int fd_in, off64_t *off_in, int fd_out, off64_t *off_out, size_t len, unsigned int flags);
+
+/* Wrappers of mmap() and mmap64() functions.
+ * Writable shared mapping of metered descriptor becomes private
+ * copy-on-write mapping, so reads are still zero-copy, and writes,
+ * which can't be counted, don't reach file.
+ */
+void *mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset);
+void *mmap64(void *addr, size_t length, int prot, int flags, int fd, off64_t offset);
+
+/* Marks beginning of persistent mode iteration.
+ * Harness calls it before every execution of target in one process,
+ * so WITH_* budgets and other state belong to iteration, not process.
+ */
+void fu53_iteration_begin(void);
+
+/* Marks end of persistent mode iteration.
+ * Calls, made by harness between iterations, aren't accounted
+ * to the next iteration.
+ */
+void fu53_iteration_end(void);
@@ -0,0 +1,187 @@
+/*
+ * Virtual input file.
+ * With FU53_INPUT=<path>, e.g. FU53_INPUT=/fu53/input, read-mode opens
+ * of <path> get descriptor of memfd, which holds current testcase of
+ * AFL++ shared memory fuzzing (__AFL_SHM_FUZZ_ID): 32-bit length and
+ * data. Target is started with <path> instead of @@, so fuzzer doesn't
+ * write testcase to disk before every execution, and target doesn't
+ * look path up. With FU53_INPUT=- testcase is placed on stdin.
+ *
+ * memfd is refilled once per execution context: in every forkserver
+ * child and persistent mode iteration. Only open(), open64(), openat(),
+ * fopen() and fopen64() see virtual path, so targets, which stat() it
+ * first, still need real file. Without shared memory virtual path is
+ * passed to original functions.
+ *
+ * AFL++ fills shared memory only after forkserver handshake with
+ * FS_OPT_SHDMEM_FUZZ, i.e. when target is built with
+ * __AFL_FUZZ_TESTCASE_BUF or links libAFLDriver. Otherwise fuzzer
+ * writes testcase to file and header stays zero, so execution with
+ * zero-length header is served by real file (or real stdin).
+ */
+
+#include "fu53.h"
+#include <sys/shm.h>
+#include <stdio_ext.h>
+
+/* memfd is moved to high descriptor like sink.
+ */
+#define INPUT_FD 1000
+
+static char path[PATH_MAX];
+static int stdin_mode;
+static const unsigned char *shm;
+static unsigned int shm_max;
+
+static int memfd = -1;
+static unsigned long filled;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+void fu53_input_init(const char *value)
+{
+	const char *id = getenv("__AFL_SHM_FUZZ_ID");
+	const char *canonical;
+	struct shmid_ds ds;
+	void *map;
+
+	if (!id)
+		return;
+
+	if (!strcmp(value, "-"))
+		stdin_mode = 1;
+	else if (!(canonical = fu53_canon(AT_FDCWD, value, path)))
+		return;
+	else if (canonical != path)
+		strncpy(path, canonical, sizeof(path) - 1);
+
+	map = shmat(atoi(id), NULL, SHM_RDONLY);
+	if (map == (void *)-1)
+		return;
+
+	if (shmctl(atoi(id), IPC_STAT, &ds) == -1 || ds.shm_segsz <= sizeof(uint32_t))
+	{
+		shmdt(map);
+		return;
+	}
+
+	shm = map;
+	shm_max = ds.shm_segsz - sizeof(uint32_t);
+	fu53_policy.input = !stdin_mode;
+
+	if (stdin_mode)
+		fu53_input_reset(0);
+}
+
+/* Returns length of testcase in shared memory,
+ * or 0, when fuzzer didn't place it there.
+ */
+static unsigned int length(void)
+{
+	unsigned int len;
+
+	memcpy(&len, shm, sizeof(len));
+	return (len > shm_max ? shm_max : len);
+}
+
+/* Returns memfd, which holds testcase of this execution.
+ */
+static int fill(void)
+{
+	unsigned long generation = __atomic_load_n(&fu53_generation, __ATOMIC_ACQUIRE);
+	unsigned int len;
+	int fd;
+
+	pthread_mutex_lock(&lock);
+	if (memfd != -1 && filled == generation)
+	{
+		pthread_mutex_unlock(&lock);
+		return memfd;
+	}
+
+	if (memfd == -1)
+	{
+		fd = memfd_create("fu53-input", MFD_CLOEXEC);
+		if (fd == -1)
+		{
+			pthread_mutex_unlock(&lock);
+			return -1;
+		}
+
+		memfd = fcntl(fd, F_DUPFD_CLOEXEC, INPUT_FD);
+		if (memfd == -1)
+			memfd = fd;
+		else
+			ORIGINAL(close)(fd);
+	}
+
+	len = length();
+	if (ftruncate(memfd, 0) == -1 || pwrite(memfd, shm + sizeof(len), len, 0) != (ssize_t)len)
+	{
+		pthread_mutex_unlock(&lock);
+		return -1;
+	}
+
+	filled = generation;
+	pthread_mutex_unlock(&lock);
+	return memfd;
+}
+
+/* Opens new file description of testcase.
+ */
+static int reopen(int flags)
+{
+	char proc[32];
+	int fd;
+
+	if (!length() || (fd = fill()) == -1)
+		return -1;
+
+	snprintf(proc, sizeof(proc), "/proc/self/fd/%d", fd);
+	return (ORIGINAL(openat)(AT_FDCWD, proc, O_RDONLY | (flags & (O_CLOEXEC | O_NONBLOCK))));
+}
+
+int fu53_input_open(int dirfd, const char *pathname, int flags)
+{
+	char buf[PATH_MAX];
+	const char *canonical;
+	int fd;
+
+	if ((flags & O_ACCMODE) != O_RDONLY)
+		return FU53_SHADOW_NONE;
+
+	canonical = fu53_canon(dirfd, pathname, buf);
+	if (!canonical || strcmp(canonical, path))
+		return FU53_SHADOW_NONE;
+
+	fd = reopen(flags);
+	return (fd == -1 ? FU53_SHADOW_NONE : fd);
+}
+
+void fu53_input_reset(int child)
+{
+	int fd;
+
+	if (!shm)
+		return;
+
+	/* memfd of parent can't be refilled by child */
+	if (child)
+	{
+		pthread_mutex_init(&lock, NULL);
+		if (memfd != -1)
+			ORIGINAL(close)(memfd);
+		memfd = -1;
+	}
+
+	if (!stdin_mode)
+		return;
+
+	fd = reopen(0);
+	if (fd == -1)
+		return;
+
+	ORIGINAL(dup2)(fd, STDIN_FILENO);
+	ORIGINAL(close)(fd);
+	__fpurge(stdin);
+	clearerr(stdin);
+}
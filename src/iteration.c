@@ -0,0 +1,56 @@
+/*
+ * Execution context of library.
+ * Counters and state of library belong to one execution. In persistent
+ * mode (AFL++ __AFL_LOOP, libFuzzer) many executions are made by one
+ * process, so harness marks them with fu53_iteration_begin() and
+ * fu53_iteration_end(). Under forkserver every execution is a forked
+ * child, so it gets new context from pthread_atfork() handler, and
+ * calls, made by parent before fork point, aren't accounted to it.
+ *
+ * Reset doesn't walk state of all threads: it bumps generation,
+ * and thread local state of older generation is dropped on its
+ * next use.
+ */
+
+#include "fu53.h"
+
+unsigned long fu53_generation = 1;
+
+static void reset(unsigned int mask, int child)
+{
+	fu53_budget_init(mask);
+	fu53_writes_reset();
+	fu53_shadow_reset(child);
+	fu53_canon_reset(child);
+	fu53_sink_reset();
+	__atomic_add_fetch(&fu53_generation, 1, __ATOMIC_RELEASE);
+	fu53_input_reset(child);
+}
+
+void fu53_reset(unsigned int mask)
+{
+	reset(mask, 0);
+}
+
+/* Child keeps rest of WITH_FORK budget of its parent,
+ * otherwise every child could fork N more children.
+ */
+static void child(void)
+{
+	reset(~(1u << FU53_FORK), 1);
+}
+
+void fu53_context_init(void)
+{
+	pthread_atfork(NULL, NULL, child);
+}
+
+void fu53_iteration_begin(void)
+{
+	fu53_reset(~0u);
+}
+
+void fu53_iteration_end(void)
+{
+	fu53_reset(~0u);
+}
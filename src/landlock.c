@@ -0,0 +1,96 @@
+/*
+ * Landlock backend.
+ * With FU53_LANDLOCK=<dir> library constructor restricts process with
+ * Landlock ruleset, so kernel checks paths of every system call, raw
+ * ones and ones of static code too. Files can be read everywhere, but
+ * written, created, removed and renamed only under <dir>. /dev/null
+ * stays writable for redirected opens. Without directory, e.g.
+ * FU53_LANDLOCK=1, nothing but /dev/null is writable.
+ *
+ * When ruleset is applied, REMOVE and RENAME wrappers pass calls to
+ * originals, and write-mode opens try originals first and fall back
+ * to /dev/null or shadow, when kernel denies them. NO_* variables and
+ * other categories are still checked by wrappers. Coverage files
+ * should be written under <dir>, e.g. with GCOV_PREFIX.
+ *
+ * Ruleset needs Linux 5.13 or newer. On older kernels library keeps
+ * its own checks.
+ */
+
+#include "fu53.h"
+#include <sys/prctl.h>
+#include <linux/landlock.h>
+
+#ifndef LANDLOCK_ACCESS_FS_REFER
+#define LANDLOCK_ACCESS_FS_REFER (1ULL << 13)
+#endif
+#ifndef LANDLOCK_ACCESS_FS_TRUNCATE
+#define LANDLOCK_ACCESS_FS_TRUNCATE (1ULL << 14)
+#endif
+
+#define WRITE_ACCESS (LANDLOCK_ACCESS_FS_WRITE_FILE | LANDLOCK_ACCESS_FS_REMOVE_DIR | LANDLOCK_ACCESS_FS_REMOVE_FILE | \
+					  LANDLOCK_ACCESS_FS_MAKE_CHAR | LANDLOCK_ACCESS_FS_MAKE_DIR | LANDLOCK_ACCESS_FS_MAKE_REG |   \
+					  LANDLOCK_ACCESS_FS_MAKE_SOCK | LANDLOCK_ACCESS_FS_MAKE_FIFO | LANDLOCK_ACCESS_FS_MAKE_BLOCK | \
+					  LANDLOCK_ACCESS_FS_MAKE_SYM)
+
+/* Rights, which can be granted on file, not directory.
+ */
+#define FILE_ACCESS (LANDLOCK_ACCESS_FS_WRITE_FILE | LANDLOCK_ACCESS_FS_TRUNCATE)
+
+/* Allows access under path.
+ */
+static int allow(int ruleset, const char *path, unsigned long long access)
+{
+	struct landlock_path_beneath_attr rule;
+	int ret;
+
+	rule.allowed_access = access;
+	rule.parent_fd = ORIGINAL(openat)(AT_FDCWD, path, O_PATH | O_CLOEXEC);
+	if (rule.parent_fd == -1)
+		return -1;
+
+	ret = fu53_raw_syscall(SYS_landlock_add_rule, ruleset, LANDLOCK_RULE_PATH_BENEATH, (long)&rule, 0, 0, 0);
+	ORIGINAL(close)(rule.parent_fd);
+	return ret;
+}
+
+int fu53_landlock_init(const char *root)
+{
+	struct landlock_ruleset_attr attr = {0};
+	long abi;
+	int ruleset;
+
+	abi = fu53_raw_syscall(SYS_landlock_create_ruleset, 0, 0, LANDLOCK_CREATE_RULESET_VERSION, 0, 0, 0);
+	if (abi < 1)
+		return -1;
+
+	attr.handled_access_fs = WRITE_ACCESS;
+	if (abi >= 2)
+		attr.handled_access_fs |= LANDLOCK_ACCESS_FS_REFER;
+	if (abi >= 3)
+		attr.handled_access_fs |= LANDLOCK_ACCESS_FS_TRUNCATE;
+
+	ruleset = fu53_raw_syscall(SYS_landlock_create_ruleset, (long)&attr, sizeof(attr), 0, 0, 0, 0);
+	if (ruleset == -1)
+		return -1;
+
+	if ((*root == '/' && allow(ruleset, root, attr.handled_access_fs) == -1) ||
+		allow(ruleset, "/dev/null", attr.handled_access_fs & FILE_ACCESS) == -1 ||
+		prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) == -1 ||
+		fu53_raw_syscall(SYS_landlock_restrict_self, ruleset, 0, 0, 0, 0, 0) == -1)
+	{
+		ORIGINAL(close)(ruleset);
+		return -1;
+	}
+
+	ORIGINAL(close)(ruleset);
+	fu53_policy.landlock = 1;
+
+	/* kernel checks paths of these categories now */
+	if (fu53_policy.action[FU53_REMOVE] == FU53_BLOCK)
+		fu53_policy.action[FU53_REMOVE] = FU53_ALLOW;
+	if (fu53_policy.action[FU53_RENAME] == FU53_BLOCK)
+		fu53_policy.action[FU53_RENAME] = FU53_ALLOW;
+
+	return 0;
+}
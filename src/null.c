@@ -0,0 +1,218 @@
+/*
+ * Null streams.
+ * Redirected write-mode fopen(), fopen64() and fdopen() get stream,
+ * made by fopencookie(), which discards written data in userland, so
+ * neither flush nor fprintf() of target makes system call. Streams come
+ * from small pool with static buffers: FILE objects of all slots are
+ * allocated by library constructor, so forkserver children inherit
+ * them, and fclose() of target returns stream to pool instead of
+ * freeing. When pool is empty, stream over /dev/null is used.
+ *
+ * Null stream has no descriptor, fileno() returns -1 for it. Targets,
+ * which pass fileno() of stream to other calls, need FU53_NULL_STREAMS=0,
+ * which keeps streams over /dev/null.
+ *
+ * freopen() keeps FILE object of caller, so target can use stream after
+ * it. libc can't reopen cookie stream, so freopen() of null stream is
+ * made by library: on /dev/null stream discards writes again, on other
+ * path its cookie gets descriptor of file, which reads, writes and seeks
+ * of stream go to. Reopened stream has no descriptor for fileno() too.
+ */
+
+#include "fu53.h"
+#include <stdio_ext.h>
+#include <wchar.h>
+
+#define STREAMS 16
+#define BUFFER 4096
+
+/* Slot of pool. fd is -1, until stream is reopened on file.
+ */
+struct entry
+{
+	FILE *stream;
+	int fd;
+	char used;
+	char buffer[BUFFER];
+};
+
+static struct entry pool[STREAMS];
+
+static char ready;
+
+/* Without file writes are discarded.
+ */
+static ssize_t put(void *cookie, const char *buf, size_t size)
+{
+	struct entry *entry = cookie;
+
+	return (entry->fd == -1 ? (ssize_t)size : ORIGINAL(write)(entry->fd, buf, size));
+}
+
+/* Without file reads see end of file.
+ */
+static ssize_t get(void *cookie, char *buf, size_t size)
+{
+	struct entry *entry = cookie;
+
+	return (entry->fd == -1 ? 0 : read(entry->fd, buf, size));
+}
+
+/* Without file stream is always at offset 0, like /dev/null.
+ */
+static int seek(void *cookie, off64_t *offset, int whence)
+{
+	struct entry *entry = cookie;
+
+	if (entry->fd == -1)
+	{
+		*offset = 0;
+		return 0;
+	}
+
+	*offset = lseek64(entry->fd, *offset, whence);
+	return (*offset == -1 ? -1 : 0);
+}
+
+static const cookie_io_functions_t null_io = {
+	.read = get,
+	.write = put,
+	.seek = seek,
+	.close = NULL,
+};
+
+/* Makes FILE object of slot.
+ */
+static FILE *make(int i)
+{
+	pool[i].fd = -1;
+	pool[i].stream = fopencookie(&pool[i], "w+", null_io);
+	if (pool[i].stream)
+		setvbuf(pool[i].stream, pool[i].buffer, _IOFBF, BUFFER);
+
+	return pool[i].stream;
+}
+
+void fu53_null_init(void)
+{
+	if (fu53_options.fd_streams)
+		return;
+
+	for (int i = 0; i < STREAMS; i++)
+		make(i);
+	ready = 1;
+}
+
+FILE *fu53_null_stream(void)
+{
+	if (!ready)
+		return NULL;
+
+	for (int i = 0; i < STREAMS; i++)
+	{
+		if (__atomic_exchange_n(&pool[i].used, 1, __ATOMIC_ACQUIRE))
+			continue;
+
+		/* slot, which stream was closed without reuse */
+		if (!pool[i].stream && !make(i))
+		{
+			__atomic_store_n(&pool[i].used, 0, __ATOMIC_RELEASE);
+			return NULL;
+		}
+
+		return pool[i].stream;
+	}
+
+	return NULL;
+}
+
+/* Returns slot of stream in pool or -1.
+ */
+static int slot(FILE *stream)
+{
+	for (int i = 0; i < STREAMS; i++)
+		if (pool[i].stream == stream && __atomic_load_n(&pool[i].used, __ATOMIC_ACQUIRE))
+			return i;
+
+	return -1;
+}
+
+int fu53_null_owned(FILE *stream)
+{
+	return (stream && slot(stream) != -1);
+}
+
+/* Writes out buffer of stream to its file and closes file,
+ * so stream discards writes again.
+ */
+static int detach(int i)
+{
+	int ret = 0;
+
+	if (pool[i].fd != -1)
+	{
+		ret = fflush(pool[i].stream);
+		if (ORIGINAL(close)(pool[i].fd) == -1)
+			ret = EOF;
+		pool[i].fd = -1;
+	}
+
+	__fpurge(pool[i].stream);
+	clearerr(pool[i].stream);
+	return ret;
+}
+
+int fu53_null_release(FILE *stream)
+{
+	int i = slot(stream);
+
+	if (i == -1)
+		return 0;
+
+	detach(i);
+
+	/* wide orientation can't be reset */
+	if (fwide(stream, 0) > 0)
+	{
+		ORIGINAL(fclose)(stream);
+		pool[i].stream = NULL;
+	}
+
+	__atomic_store_n(&pool[i].used, 0, __ATOMIC_RELEASE);
+	return 1;
+}
+
+FILE *fu53_null_reopen(const char *path, const char *mode, FILE *stream)
+{
+	int i = slot(stream), flags = fu53_mode_flags(mode), fd = -1;
+	char proc[32];
+
+	if (i == -1)
+	{
+		errno = EBADF;
+		return NULL;
+	}
+
+	/* without path file of stream is reopened with new mode */
+	if (!path && pool[i].fd != -1)
+	{
+		snprintf(proc, sizeof(proc), "/proc/self/fd/%d", pool[i].fd);
+		path = proc;
+		flags &= ~O_EXCL;
+	}
+
+	if (path && strcmp(path, "/dev/null"))
+	{
+		fd = fu53_fd_fresh(ORIGINAL(openat)(AT_FDCWD, path, flags, 0666));
+		if (fd == -1)
+		{
+			/* like libc, stream is closed even if open fails */
+			detach(i);
+			return NULL;
+		}
+	}
+
+	detach(i);
+	pool[i].fd = fd;
+	return stream;
+}
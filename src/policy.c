@@ -0,0 +1,295 @@
+/*
+ * Policy of library.
+ * All WITH_* and NO_* variables are parsed once, when library is
+ * loaded, so wrappers don't call getenv() and don't have lazy
+ * initialization on their paths. Every forkserver child inherits
+ * already parsed policy and resolved originals from its parent.
+ *
+ * Library, built with make POLICY=<file>, has policy of categories
+ * baked in from WITH_* and NO_* lines of file. Wrappers read it as
+ * constants, so checks of categories are folded by compiler, and
+ * variables of categories are ignored. WITH_COVERAGE of file and
+ * environment, and FU53_* variables still work.
+ */
+
+#include "fu53.h"
+
+struct fu53_policy fu53_policy;
+unsigned int fu53_limits[FU53_CATEGORIES];
+struct fu53_options fu53_options;
+
+/* Suffixes of coverage files, which can be written with WITH_COVERAGE.
+ * Last characters of all suffixes are kept in bitmap, so most of paths
+ * are rejected by one lookup.
+ */
+static struct
+{
+	unsigned char last[32];
+	unsigned char count;
+	unsigned char len[FU53_SUFFIXES];
+	char suffix[FU53_SUFFIXES][FU53_SUFFIX_LEN];
+} coverage;
+
+static unsigned long coverage_opens;
+
+/* Names of categories after WITH_ and NO_ prefixes.
+ * Crash is set for categories, which support NO_* variable.
+ */
+static const struct
+{
+	const char *name;
+	char crash;
+} categories[FU53_CATEGORIES] = {
+	[FU53_OPEN] = {"OPEN", 1},
+	[FU53_REMOVE] = {"REMOVE", 0},
+	[FU53_EXEC] = {"EXEC", 1},
+	[FU53_RENAME] = {"RENAME", 0},
+	[FU53_CHANGE] = {"CHANGE", 0},
+	[FU53_SYSTEM] = {"SYSTEM", 0},
+	[FU53_FORK] = {"FORK", 0},
+	[FU53_PARALLEL] = {"PARALLEL", 0},
+	[FU53_DUP] = {"DUP", 0},
+	[FU53_ENV] = {"ENV", 0},
+	[FU53_UNSHARE] = {"UNSHARE", 0},
+	[FU53_MOUNT] = {"MOUNT", 0},
+};
+
+static void add_suffix(const char *suffix, size_t len)
+{
+	unsigned char last;
+
+	if (!len || len >= FU53_SUFFIX_LEN || coverage.count == FU53_SUFFIXES)
+		return;
+
+	last = suffix[len - 1];
+	memcpy(coverage.suffix[coverage.count], suffix, len);
+	coverage.len[coverage.count++] = len;
+	coverage.last[last / 8] |= 1 << (last % 8);
+}
+
+/* Parses value of WITH_COVERAGE.
+ * Value may be list of suffixes separated by ':' or ',',
+ * otherwise gcov and llvm-profdata suffixes are used.
+ */
+static void parse_coverage(const char *value)
+{
+	size_t len;
+
+	fu53_policy.coverage = 1;
+
+	if (*value != '.')
+		value = ".gcda:.gcno:.profraw:.profdata";
+
+	while (*value)
+	{
+		len = strcspn(value, ":,");
+		add_suffix(value, len);
+		value += len;
+		if (*value)
+			value++;
+	}
+}
+
+int fu53_coverage_exempt(const char *pathname)
+{
+	size_t len = strlen(pathname);
+	unsigned char last;
+
+	if (!len)
+		return 0;
+
+	last = pathname[len - 1];
+	if (!(coverage.last[last / 8] & (1 << (last % 8))))
+		return 0;
+
+	for (int i = 0; i < coverage.count; i++)
+	{
+		if (len < coverage.len[i])
+			continue;
+
+		if (!memcmp(pathname + len - coverage.len[i], coverage.suffix[i], coverage.len[i]))
+		{
+			__atomic_add_fetch(&coverage_opens, 1, __ATOMIC_RELAXED);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+unsigned long fu53_coverage_count(void)
+{
+	return __atomic_load_n(&coverage_opens, __ATOMIC_RELAXED);
+}
+
+/* Compares name of variable, terminated by '=', with category name.
+ */
+static int match(const char *var, const char *name)
+{
+	size_t len = strlen(name);
+	return (!strncmp(var, name, len) && var[len] == '=');
+}
+
+static void parse(const char *var, int crash)
+{
+	const char *value;
+	unsigned long num;
+
+	if (!crash && match(var, "COVERAGE"))
+	{
+		parse_coverage(var + sizeof("COVERAGE"));
+		return;
+	}
+
+	for (int i = 0; i < FU53_CATEGORIES; i++)
+	{
+		if (!match(var, categories[i].name))
+			continue;
+
+		if (crash)
+		{
+			if (categories[i].crash)
+				fu53_policy.action[i] = FU53_CRASH;
+			return;
+		}
+
+		/* NO_* takes precedence over WITH_* */
+		if (fu53_policy.action[i] != FU53_CRASH)
+			fu53_policy.action[i] = FU53_ALLOW;
+
+		value = var + strlen(categories[i].name) + 1;
+		num = strtoul(value, NULL, 10);
+		fu53_limits[i] = (num > UINT_MAX ? UINT_MAX : num);
+		return;
+	}
+}
+
+/* Parses size with optional k, M or G suffix.
+ */
+static unsigned long size(const char *value)
+{
+	char *end;
+	unsigned long num = strtoul(value, &end, 10);
+
+	switch (*end)
+	{
+	case 'g':
+	case 'G':
+		num <<= 10;
+		/* fall through */
+	case 'm':
+	case 'M':
+		num <<= 10;
+		/* fall through */
+	case 'k':
+	case 'K':
+		num <<= 10;
+	}
+
+	return (num > LONG_MAX ? LONG_MAX : num);
+}
+
+static unsigned char spent(const char *value)
+{
+	if (!strcmp(value, "sink"))
+		return FU53_SPENT_SINK;
+	if (!strcmp(value, "crash"))
+		return FU53_SPENT_CRASH;
+
+	return FU53_SPENT_ENOSPC;
+}
+
+/* Parses FU53_* variables, which tune library.
+ */
+static void option(const char *var)
+{
+	if (match(var, "BUDGET"))
+		fu53_policy.quota = !strcmp(var + sizeof("BUDGET"), "thread");
+	else if (match(var, "SHADOW"))
+		fu53_policy.shadow = strcmp(var + sizeof("SHADOW"), "0") != 0;
+	else if (match(var, "SINK_MAX"))
+		fu53_options.sink_max = strtoul(var + sizeof("SINK_MAX"), NULL, 10);
+	else if (match(var, "SECCOMP"))
+		fu53_options.seccomp = strcmp(var + sizeof("SECCOMP"), "0") != 0;
+	else if (match(var, "RULES"))
+		fu53_options.rules = var + sizeof("RULES");
+	else if (match(var, "CACHE"))
+		fu53_options.cache = var + sizeof("CACHE");
+	else if (match(var, "INPUT"))
+		fu53_options.input = var + sizeof("INPUT");
+	else if (match(var, "STATS"))
+		fu53_options.stats = var + sizeof("STATS");
+	else if (match(var, "PROFILE"))
+		fu53_options.profile = var + sizeof("PROFILE");
+	else if (match(var, "LANDLOCK"))
+		fu53_options.landlock = var + sizeof("LANDLOCK");
+	else if (match(var, "WRITE_BYTES"))
+		fu53_options.write_bytes = size(var + sizeof("WRITE_BYTES"));
+	else if (match(var, "WRITE_FILES"))
+		fu53_options.write_files = strtoul(var + sizeof("WRITE_FILES"), NULL, 10);
+	else if (match(var, "NULL_STREAMS"))
+		fu53_options.fd_streams = !strcmp(var + sizeof("NULL_STREAMS"), "0");
+	else if (match(var, "SELECT"))
+		fu53_options.generic = !strcmp(var + sizeof("SELECT"), "0");
+	else if (match(var, "WRITE_ACTION"))
+		fu53_options.write_action = spent(var + sizeof("WRITE_ACTION"));
+}
+
+__attribute__((constructor(101))) void fu53_init(void)
+{
+	extern char **environ;
+	static char ready = 0;
+
+	if (ready)
+		return;
+	ready = 1;
+
+	for (char **env = environ; env && *env; env++)
+	{
+		if (!strncmp(*env, "WITH_", 5))
+			parse(*env + 5, 0);
+		else if (!strncmp(*env, "NO_", 3))
+			parse(*env + 3, 1);
+		else if (!strncmp(*env, "FU53_", 5))
+			option(*env + 5);
+	}
+
+#ifdef FU53_BAKED
+	/* baked policy overrides variables of categories */
+	memcpy(fu53_policy.action, fu53_baked_action, sizeof(fu53_baked_action));
+	memcpy(fu53_limits, fu53_baked_limit, sizeof(fu53_baked_limit));
+#ifdef FU53_BAKED_COVERAGE
+	parse_coverage(FU53_BAKED_COVERAGE);
+#endif
+#endif
+
+	fu53_budget_init(~0u);
+	fu53_policy.writes = (fu53_options.write_bytes || fu53_options.write_files);
+	fu53_writes_reset();
+#ifndef FU53_WRAP
+	fu53_resolve(FU53_FN_open);
+#endif
+	if (fu53_options.stats)
+		fu53_stats_init(fu53_options.stats);
+#ifdef FU53_PROFILE
+	if (fu53_options.profile)
+		fu53_profile_init(fu53_options.profile);
+#endif
+	fu53_canon_chdir();
+	if (fu53_options.cache)
+		fu53_cache_init(fu53_options.cache);
+	if (fu53_options.input)
+		fu53_input_init(fu53_options.input);
+	if (fu53_options.rules && fu53_rules_init(fu53_options.rules) == -1)
+		abort();
+	fu53_sink_init();
+	fu53_null_init();
+	fu53_context_init();
+	if (fu53_options.landlock && strcmp(fu53_options.landlock, "0"))
+		fu53_landlock_init(fu53_options.landlock);
+	if (fu53_options.seccomp)
+		fu53_seccomp_init();
+#ifdef FU53_SELECT
+	fu53_select();
+#endif
+}
@@ -0,0 +1,196 @@
+/*
+ * Profiling of wrappers.
+ * Library, built with FU53_PROFILE (make PROFILE=1), times every call
+ * of wrappers with cycle counter. Call is split at the moment, when
+ * wrapper counts its outcome (see stats.c): time before it is spent by
+ * library, time after it is spent by original function, when call is
+ * allowed, and by library again, when it's redirected or blocked. Time
+ * of original function includes bookkeeping after it, e.g. tracking of
+ * sink descriptors by dup() and close().
+ *
+ * Samples go into log-linear histograms of every function and phase.
+ * With FU53_PROFILE=<name> histograms are mapped at /dev/shm/<name> and
+ * are shared by forked children. With FU53_PROFILE=- process, which
+ * loaded library, prints them to stderr on exit, one line per function
+ * and phase:
+ *   fu53-profile <function> <self|libc> <count> <mean> <p50> <p90> <p99>
+ * with times in nanoseconds.
+ *
+ * Library without FU53_PROFILE has no profiling code at all.
+ */
+
+#include "fu53.h"
+
+#ifdef FU53_PROFILE
+
+static struct fu53_profile block;
+static struct fu53_profile *profile = &block;
+static int report;
+
+__thread struct fu53_sample *fu53_sample __attribute__((tls_model("initial-exec")));
+
+static const char *const names[FU53_FUNCTIONS_COUNT] = {
+#define X(name, ...) [FU53_FN_##name] = #name,
+	FU53_FUNCTIONS(X)
+#undef X
+};
+
+static unsigned long now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ul + ts.tv_nsec;
+}
+
+/* Returns bucket of histogram for ticks.
+ */
+static unsigned int bucket(unsigned long ticks)
+{
+	unsigned int power, index;
+
+	if (ticks < FU53_LINEAR)
+		return ticks;
+
+	power = 63 - __builtin_clzl(ticks);
+	index = FU53_LINEAR + (power - __builtin_ctz(FU53_LINEAR)) * FU53_STEPS +
+			((ticks >> (power - __builtin_ctz(FU53_STEPS))) & (FU53_STEPS - 1));
+
+	return (index < FU53_BUCKETS ? index : FU53_BUCKETS - 1);
+}
+
+/* Returns lowest ticks of bucket.
+ */
+static unsigned long lowest(unsigned int index)
+{
+	unsigned int power;
+
+	if (index < FU53_LINEAR)
+		return index;
+
+	index -= FU53_LINEAR;
+	power = index / FU53_STEPS + __builtin_ctz(FU53_LINEAR);
+	return ((unsigned long)(FU53_STEPS + index % FU53_STEPS) << (power - __builtin_ctz(FU53_STEPS)));
+}
+
+static void record(struct fu53_histogram *histogram, unsigned long ticks)
+{
+	__atomic_add_fetch(&histogram->count, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&histogram->sum, ticks, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&histogram->bucket[bucket(ticks)], 1, __ATOMIC_RELAXED);
+}
+
+void fu53_profile_exit(struct fu53_sample *sample)
+{
+	unsigned long end = fu53_ticks();
+	struct fu53_histogram *histogram = profile->histogram[sample->id];
+	unsigned long libc = 0;
+
+	fu53_sample = sample->outer;
+
+	if (sample->outcome == FU53_ALLOWED)
+	{
+		libc = end - sample->mark;
+		record(&histogram[FU53_LIBC], libc);
+	}
+
+	record(&histogram[FU53_SELF], end - sample->start - libc);
+}
+
+static void header(struct fu53_profile *block)
+{
+	memcpy(block->magic, FU53_PROFILE_MAGIC, sizeof(block->magic));
+	block->version = FU53_PROFILE_VERSION;
+	block->functions = FU53_FUNCTIONS_COUNT;
+	block->buckets = FU53_BUCKETS;
+	block->pid = getpid();
+	block->ns = now();
+	block->ticks = fu53_ticks();
+
+	for (int i = 0; i < FU53_FUNCTIONS_COUNT; i++)
+		strncpy(block->name[i], names[i], FU53_NAME_LEN - 1);
+}
+
+/* Returns ticks, which quantile of samples doesn't exceed.
+ */
+static unsigned long quantile(const struct fu53_histogram *histogram, unsigned long permille)
+{
+	unsigned long rank = (histogram->count * permille + 999) / 1000, seen = 0;
+
+	for (unsigned int i = 0; i < FU53_BUCKETS; i++)
+	{
+		seen += histogram->bucket[i];
+		if (seen >= rank)
+			return lowest(i);
+	}
+
+	return lowest(FU53_BUCKETS - 1);
+}
+
+__attribute__((destructor)) static void print(void)
+{
+	static const char *const phases[FU53_PHASES] = {"self", "libc"};
+	const struct fu53_histogram *histogram;
+	unsigned long ticks, ns;
+	double scale;
+
+	if (!report || getpid() != profile->pid)
+		return;
+
+	ticks = fu53_ticks() - profile->ticks;
+	ns = now() - profile->ns;
+	scale = (ticks ? (double)ns / ticks : 1.0);
+
+	for (int i = 0; i < FU53_FUNCTIONS_COUNT; i++)
+	{
+		for (int phase = 0; phase < FU53_PHASES; phase++)
+		{
+			histogram = &profile->histogram[i][phase];
+			if (!histogram->count)
+				continue;
+
+			fprintf(stderr, "fu53-profile %s %s %lu %.0f %.0f %.0f %.0f\n", names[i], phases[phase], histogram->count,
+					scale * histogram->sum / histogram->count, scale * quantile(histogram, 500),
+					scale * quantile(histogram, 900), scale * quantile(histogram, 990));
+		}
+	}
+}
+
+int fu53_profile_init(const char *name)
+{
+	char path[PATH_MAX];
+	struct fu53_profile *block;
+	int fd;
+
+	header(profile);
+
+	if (!strcmp(name, "-"))
+	{
+		report = 1;
+		return 0;
+	}
+
+	if (snprintf(path, sizeof(path), "/dev/shm/%s", name) >= (int)sizeof(path))
+		return -1;
+
+	fd = ORIGINAL(openat)(AT_FDCWD, path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (fd == -1)
+		return -1;
+
+	if (ftruncate(fd, sizeof(*block)) == -1)
+	{
+		ORIGINAL(close)(fd);
+		return -1;
+	}
+
+	block = ORIGINAL(mmap)(NULL, sizeof(*block), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	ORIGINAL(close)(fd);
+	if (block == MAP_FAILED)
+		return -1;
+
+	memcpy(block, profile, sizeof(*block));
+	__atomic_store_n(&profile, block, __ATOMIC_RELEASE);
+	return 0;
+}
+
+#endif
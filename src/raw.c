@@ -0,0 +1,377 @@
+/*
+ * Fallbacks of original functions.
+ * They are used, when original function can't be resolved with
+ * dlsym(RTLD_NEXT), e.g. in static binaries, or when wrapper is called
+ * while table of originals is being resolved. Functions, which map to
+ * system calls, are made with raw syscall instruction, so they don't
+ * depend on libc at all. Other functions fail with ENOSYS.
+ * Library, linked with ld --wrap, calls originals directly and has
+ * no fallbacks.
+ */
+
+#include "fu53.h"
+
+long fu53_raw_syscall(long number, long a0, long a1, long a2, long a3, long a4, long a5)
+{
+	long ret = fu53_raw(number, a0, a1, a2, a3, a4, a5);
+
+	if (ret < 0 && ret > -4096)
+	{
+		errno = -ret;
+		return -1;
+	}
+
+	return ret;
+}
+
+#ifndef FU53_WRAP
+#define RAW(number, a0, a1, a2, a3, a4) \
+	fu53_raw_syscall(number, (long)(a0), (long)(a1), (long)(a2), (long)(a3), (long)(a4), 0)
+
+static int fail(void)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+static void *fail_null(void)
+{
+	errno = ENOSYS;
+	return NULL;
+}
+
+static int raw_open(const char *pathname, int flags, ...)
+{
+	va_list arg;
+	mode_t mode;
+
+	va_start(arg, flags);
+	mode = va_arg(arg, mode_t);
+	va_end(arg);
+
+	return RAW(SYS_openat, AT_FDCWD, pathname, flags, mode, 0);
+}
+
+static int raw_openat(int dirfd, const char *pathname, int flags, ...)
+{
+	va_list arg;
+	mode_t mode;
+
+	va_start(arg, flags);
+	mode = va_arg(arg, mode_t);
+	va_end(arg);
+
+	return RAW(SYS_openat, dirfd, pathname, flags, mode, 0);
+}
+
+static int raw_creat(const char *pathname, mode_t mode)
+{
+	return RAW(SYS_openat, AT_FDCWD, pathname, O_CREAT | O_WRONLY | O_TRUNC, mode, 0);
+}
+
+static int raw_unlinkat(int dirfd, const char *pathname, int flags)
+{
+	return RAW(SYS_unlinkat, dirfd, pathname, flags, 0, 0);
+}
+
+static int raw_unlink(const char *pathname)
+{
+	return raw_unlinkat(AT_FDCWD, pathname, 0);
+}
+
+static int raw_rmdir(const char *pathname)
+{
+	return raw_unlinkat(AT_FDCWD, pathname, AT_REMOVEDIR);
+}
+
+static int raw_remove(const char *pathname)
+{
+	int ret = raw_unlink(pathname);
+
+	if (ret == -1 && errno == EISDIR)
+		return raw_rmdir(pathname);
+
+	return ret;
+}
+
+static int raw_execve(const char *path, char *const argv[], char *const envp[])
+{
+	return RAW(SYS_execve, path, argv, envp, 0, 0);
+}
+
+static int raw_execv(const char *path, char *const argv[])
+{
+	extern char **environ;
+	return raw_execve(path, argv, environ);
+}
+
+static int raw_execveat(int dirfd, const char *pathname, char *const argv[], char *const envp[], int flags)
+{
+	return RAW(SYS_execveat, dirfd, pathname, argv, envp, flags);
+}
+
+static int raw_fexecve(int fd, char *const argv[], char *const envp[])
+{
+	return raw_execveat(fd, "", argv, envp, AT_EMPTY_PATH);
+}
+
+static int raw_renameat2(int olddirfd, const char *oldpath, int newdirfd, const char *newpath, unsigned int flags)
+{
+	return RAW(SYS_renameat2, olddirfd, oldpath, newdirfd, newpath, flags);
+}
+
+static int raw_renameat(int olddirfd, const char *oldpath, int newdirfd, const char *newpath)
+{
+	return raw_renameat2(olddirfd, oldpath, newdirfd, newpath, 0);
+}
+
+static int raw_rename(const char *oldpath, const char *newpath)
+{
+	return raw_renameat2(AT_FDCWD, oldpath, AT_FDCWD, newpath, 0);
+}
+
+static int raw_fchownat(int dirfd, const char *pathname, uid_t owner, gid_t group, int flags)
+{
+	return RAW(SYS_fchownat, dirfd, pathname, owner, group, flags);
+}
+
+static int raw_chown(const char *path, uid_t owner, gid_t group)
+{
+	return raw_fchownat(AT_FDCWD, path, owner, group, 0);
+}
+
+static int raw_fchmodat(int dirfd, const char *pathname, mode_t mode, int flags)
+{
+	/* fchmodat system call doesn't take flags */
+	if (flags)
+	{
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+
+	return RAW(SYS_fchmodat, dirfd, pathname, mode, 0, 0);
+}
+
+static int raw_chmod(const char *pathname, mode_t mode)
+{
+	return raw_fchmodat(AT_FDCWD, pathname, mode, 0);
+}
+
+static long raw_syscall(long number, ...)
+{
+	va_list args;
+
+	va_start(args, number);
+	long int a0 = va_arg(args, long int);
+	long int a1 = va_arg(args, long int);
+	long int a2 = va_arg(args, long int);
+	long int a3 = va_arg(args, long int);
+	long int a4 = va_arg(args, long int);
+	long int a5 = va_arg(args, long int);
+	va_end(args);
+
+	return fu53_raw_syscall(number, a0, a1, a2, a3, a4, a5);
+}
+
+static int raw_chroot(const char *path)
+{
+	return RAW(SYS_chroot, path, 0, 0, 0, 0);
+}
+
+static pid_t raw_fork(void)
+{
+	return RAW(SYS_clone, SIGCHLD, 0, 0, 0, 0);
+}
+
+static int raw_mknodat(int dirfd, const char *pathname, mode_t mode, dev_t dev)
+{
+	return RAW(SYS_mknodat, dirfd, pathname, mode, dev, 0);
+}
+
+static int raw_mknod(const char *pathname, mode_t mode, dev_t dev)
+{
+	return raw_mknodat(AT_FDCWD, pathname, mode, dev);
+}
+
+static int raw_mkfifoat(int dirfd, const char *pathname, mode_t mode)
+{
+	return raw_mknodat(dirfd, pathname, mode | S_IFIFO, 0);
+}
+
+static int raw_mkfifo(const char *pathname, mode_t mode)
+{
+	return raw_mknodat(AT_FDCWD, pathname, mode | S_IFIFO, 0);
+}
+
+static int raw_semctl(int semid, int semnum, int cmd, ...)
+{
+	va_list args;
+	long arg;
+
+	va_start(args, cmd);
+	arg = va_arg(args, long);
+	va_end(args);
+
+	return RAW(SYS_semctl, semid, semnum, cmd, arg, 0);
+}
+
+static int raw_semget(key_t key, int nsems, int semflg)
+{
+	return RAW(SYS_semget, key, nsems, semflg, 0, 0);
+}
+
+static int raw_pipe(int pipefd[2])
+{
+	return RAW(SYS_pipe2, pipefd, 0, 0, 0, 0);
+}
+
+static int raw_dup(int oldfd)
+{
+	return RAW(SYS_dup, oldfd, 0, 0, 0, 0);
+}
+
+static int raw_dup3(int oldfd, int newfd, int flags)
+{
+	return RAW(SYS_dup3, oldfd, newfd, flags, 0, 0);
+}
+
+static int raw_dup2(int oldfd, int newfd)
+{
+	/* dup3() fails on equal descriptors, dup2() checks oldfd */
+	if (oldfd == newfd)
+		return (RAW(SYS_fcntl, oldfd, F_GETFD, 0, 0, 0) == -1 ? -1 : newfd);
+
+	return raw_dup3(oldfd, newfd, 0);
+}
+
+static int raw_unshare(int flags)
+{
+	return RAW(SYS_unshare, flags, 0, 0, 0, 0);
+}
+
+static int raw_mount(const char *source, const char *target, const char *filesystemtype, unsigned long mountflags, const void *data)
+{
+	return RAW(SYS_mount, source, target, filesystemtype, mountflags, data);
+}
+
+static int raw_close(int fd)
+{
+	return RAW(SYS_close, fd, 0, 0, 0, 0);
+}
+
+static int raw_chdir(const char *path)
+{
+	return RAW(SYS_chdir, path, 0, 0, 0, 0);
+}
+
+static int raw_fchdir(int fd)
+{
+	return RAW(SYS_fchdir, fd, 0, 0, 0, 0);
+}
+
+static ssize_t raw_write(int fd, const void *buf, size_t count)
+{
+	return RAW(SYS_write, fd, buf, count, 0, 0);
+}
+
+static ssize_t raw_writev(int fd, const struct iovec *iov, int iovcnt)
+{
+	return RAW(SYS_writev, fd, iov, iovcnt, 0, 0);
+}
+
+static ssize_t raw_pwrite(int fd, const void *buf, size_t count, off_t offset)
+{
+	return RAW(SYS_pwrite64, fd, buf, count, offset, 0);
+}
+
+static ssize_t raw_sendfile(int out_fd, int in_fd, off_t *offset, size_t count)
+{
+	return RAW(SYS_sendfile, out_fd, in_fd, offset, count, 0);
+}
+
+static ssize_t raw_copy_file_range(int fd_in, off64_t *off_in, int fd_out, off64_t *off_out, size_t len, unsigned int flags)
+{
+	return fu53_raw_syscall(SYS_copy_file_range, fd_in, (long)off_in, fd_out, (long)off_out, len, flags);
+}
+
+static int raw_close_range(unsigned int first, unsigned int last, int flags)
+{
+	return RAW(SYS_close_range, first, last, flags, 0, 0);
+}
+
+static void raw_closefrom(int lowfd)
+{
+	RAW(SYS_close_range, lowfd, ~0u, 0, 0, 0);
+}
+
+static void *raw_mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
+{
+	return (void *)fu53_raw_syscall(SYS_mmap, (long)addr, length, prot, flags, fd, offset);
+}
+
+void *const fu53_fallbacks[FU53_FUNCTIONS_COUNT] = {
+	[FU53_FN_open] = raw_open,
+	[FU53_FN_open64] = raw_open,
+	[FU53_FN_openat] = raw_openat,
+	[FU53_FN_creat] = raw_creat,
+	[FU53_FN_dlopen] = fail_null,
+	[FU53_FN_fopen] = fail_null,
+	[FU53_FN_fopen64] = fail_null,
+	[FU53_FN_fdopen] = fail_null,
+	[FU53_FN_freopen] = fail_null,
+	[FU53_FN_remove] = raw_remove,
+	[FU53_FN_rmdir] = raw_rmdir,
+	[FU53_FN_unlink] = raw_unlink,
+	[FU53_FN_unlinkat] = raw_unlinkat,
+	[FU53_FN_execv] = raw_execv,
+	[FU53_FN_execve] = raw_execve,
+	[FU53_FN_execvp] = fail,
+	[FU53_FN_execvpe] = fail,
+	[FU53_FN_execveat] = raw_execveat,
+	[FU53_FN_fexecve] = raw_fexecve,
+	[FU53_FN_rename] = raw_rename,
+	[FU53_FN_renameat] = raw_renameat,
+	[FU53_FN_renameat2] = raw_renameat2,
+	[FU53_FN_chown] = raw_chown,
+	[FU53_FN_fchownat] = raw_fchownat,
+	[FU53_FN_chmod] = raw_chmod,
+	[FU53_FN_fchmodat] = raw_fchmodat,
+	[FU53_FN_system] = fail,
+	[FU53_FN_syscall] = raw_syscall,
+	[FU53_FN_chroot] = raw_chroot,
+	[FU53_FN_fork] = raw_fork,
+	[FU53_FN_popen] = fail_null,
+	[FU53_FN_mkfifo] = raw_mkfifo,
+	[FU53_FN_mkfifoat] = raw_mkfifoat,
+	[FU53_FN_mknod] = raw_mknod,
+	[FU53_FN_mknodat] = raw_mknodat,
+	[FU53_FN_sem_open] = fail_null,
+	[FU53_FN_semctl] = raw_semctl,
+	[FU53_FN_semget] = raw_semget,
+	[FU53_FN_pipe] = raw_pipe,
+	[FU53_FN_dup] = raw_dup,
+	[FU53_FN_dup2] = raw_dup2,
+	[FU53_FN_dup3] = raw_dup3,
+	[FU53_FN_setenv] = fail,
+	[FU53_FN_unsetenv] = fail,
+	[FU53_FN_unshare] = raw_unshare,
+	[FU53_FN_mount] = raw_mount,
+	[FU53_FN_close] = raw_close,
+	[FU53_FN_close_range] = raw_close_range,
+	[FU53_FN_closefrom] = raw_closefrom,
+	[FU53_FN_closedir] = fail,
+	[FU53_FN_chdir] = raw_chdir,
+	[FU53_FN_fchdir] = raw_fchdir,
+	[FU53_FN_fclose] = fail,
+	[FU53_FN_write] = raw_write,
+	[FU53_FN_writev] = raw_writev,
+	[FU53_FN_pwrite] = raw_pwrite,
+	[FU53_FN_pwrite64] = raw_pwrite,
+	[FU53_FN_sendfile] = raw_sendfile,
+	[FU53_FN_sendfile64] = raw_sendfile,
+	[FU53_FN_copy_file_range] = raw_copy_file_range,
+	[FU53_FN_mmap] = raw_mmap,
+	[FU53_FN_mmap64] = raw_mmap,
+};
+
+#endif
@@ -0,0 +1,525 @@
+/*
+ * Path rules.
+ * FU53_RULES=<file> loads rules, which allow or deny operations on
+ * paths matching glob, one per line:
+ *
+ *   allow write,remove /tmp/fuzz-**
+ *   deny read /etc/shadow
+ *
+ * Operations are read, write, remove, rename, change (chmod/chown) or
+ * all. In globs '*' matches any characters except '/', '**' matches
+ * any characters, '?' matches one character except '/', '\' escapes
+ * next character. Lines starting with '#' and empty lines are
+ * comments. The last matching rule wins. Allowed calls go to original
+ * functions whatever category policy is, denied calls fail with
+ * EACCES, and calls without matching rule follow category policy.
+ * NO_* variables still crash. Rules take precedence over other
+ * redirections too: allowed read opens the real file, not its shadow
+ * copy, FU53_CACHE memfd or FU53_INPUT testcase. With rules seccomp
+ * filter doesn't deny calls of path categories, so rules hold under
+ * FU53_SECCOMP=1 too.
+ *
+ * Rules file, which can't be read or compiled, is fatal: library
+ * reports file, line and reason on stderr and calls abort(), because
+ * fuzzing with partially loaded rules is silently unsafe.
+ *
+ * All rules are compiled by library constructor into one DFA over byte
+ * classes, so every decision costs one table lookup per character of
+ * path, and number of rules doesn't matter. Paths are matched in
+ * canonical form (see canon.c), so relative and dirfd-relative paths
+ * and ".." components can't bypass rules.
+ */
+
+#include "fu53.h"
+
+/* Elements of compiled globs, literal characters are 0-255.
+ */
+enum
+{
+	ANY = 256,
+	STAR,
+	DSTAR,
+	END,
+};
+
+#define STATES 65535
+#define CHUNK 1024
+#define HASH (2 * STATES + 1)
+#define LINE (PATH_MAX + 64)
+
+static struct
+{
+	unsigned short *element;
+	unsigned char *ops;		/* of END elements */
+	unsigned char *verdict; /* of END elements */
+	unsigned int count;
+	unsigned int size;
+} nfa;
+
+static struct
+{
+	unsigned int classes;
+	unsigned char class[256];
+	unsigned short *next;
+	unsigned short *verdict;
+} dfa;
+
+/* Reason of the last failure.
+ */
+static const char *reason;
+
+static const char *const ops[FU53_OPS] = {
+	[FU53_OP_READ] = "read",
+	[FU53_OP_WRITE] = "write",
+	[FU53_OP_REMOVE] = "remove",
+	[FU53_OP_RENAME] = "rename",
+	[FU53_OP_CHANGE] = "change",
+};
+
+static int push(unsigned short element, unsigned char op, unsigned char verdict)
+{
+	void *ptr;
+
+	if (nfa.count == nfa.size)
+	{
+		nfa.size = nfa.size ? nfa.size * 2 : 1024;
+		reason = "out of memory";
+		if (!(ptr = realloc(nfa.element, nfa.size * sizeof(*nfa.element))))
+			return -1;
+		nfa.element = ptr;
+		if (!(ptr = realloc(nfa.ops, nfa.size)))
+			return -1;
+		nfa.ops = ptr;
+		if (!(ptr = realloc(nfa.verdict, nfa.size)))
+			return -1;
+		nfa.verdict = ptr;
+	}
+
+	nfa.element[nfa.count] = element;
+	nfa.ops[nfa.count] = op;
+	nfa.verdict[nfa.count++] = verdict;
+	return 0;
+}
+
+/* Parses comma-separated list of operations into mask.
+ * Returns 0, when list has unknown operation.
+ */
+static unsigned char parse_ops(const char *list, size_t len)
+{
+	unsigned char mask = 0, op;
+	size_t n;
+
+	while (len)
+	{
+		n = strcspn(list, ",");
+		if (n > len)
+			n = len;
+
+		op = 0;
+		if (n == 3 && !strncmp(list, "all", 3))
+			op = (1 << FU53_OPS) - 1;
+
+		for (int i = 0; i < FU53_OPS; i++)
+			if (strlen(ops[i]) == n && !strncmp(list, ops[i], n))
+				op = 1 << i;
+
+		if (!op)
+			return 0;
+		mask |= op;
+
+		list += n;
+		len -= n;
+		if (len)
+			list++, len--;
+	}
+
+	return mask;
+}
+
+/* Parses rule and appends its glob to NFA.
+ * Returns -1 and sets reason, when line isn't valid rule.
+ */
+static int parse_rule(char *line)
+{
+	unsigned char verdict, mask;
+	size_t len;
+	char *glob;
+
+	line += strspn(line, " \t");
+	if (*line == '#' || !line[strspn(line, " \t\r\n")])
+		return 0;
+
+	if (!strncmp(line, "allow", 5) && (line[5] == ' ' || line[5] == '\t'))
+		verdict = FU53_RULE_ALLOW, line += 5;
+	else if (!strncmp(line, "deny", 4) && (line[4] == ' ' || line[4] == '\t'))
+		verdict = FU53_RULE_DENY, line += 4;
+	else
+	{
+		reason = "rule must start with \"allow\" or \"deny\"";
+		return -1;
+	}
+
+	line += strspn(line, " \t");
+	len = strcspn(line, " \t\r\n");
+	if (!(mask = parse_ops(line, len)))
+	{
+		reason = "unknown operation";
+		return -1;
+	}
+	glob = line + len;
+	glob += strspn(glob, " \t");
+
+	len = strcspn(glob, "\r\n");
+	while (len && (glob[len - 1] == ' ' || glob[len - 1] == '\t'))
+		len--;
+
+	if (!len)
+	{
+		reason = "glob is missing";
+		return -1;
+	}
+
+	for (size_t i = 0; i < len; i++)
+	{
+		unsigned short element = (unsigned char)glob[i];
+
+		if (glob[i] == '*' && i + 1 < len && glob[i + 1] == '*')
+			element = DSTAR, i++;
+		else if (glob[i] == '*')
+			element = STAR;
+		else if (glob[i] == '?')
+			element = ANY;
+		else if (glob[i] == '\\' && i + 1 < len)
+			element = (unsigned char)glob[++i];
+
+		/* consecutive stars are the same */
+		if (element >= STAR && nfa.count && nfa.element[nfa.count - 1] >= STAR && nfa.element[nfa.count - 1] != END)
+		{
+			nfa.element[nfa.count - 1] = DSTAR;
+			continue;
+		}
+
+		if (push(element, 0, 0) == -1)
+			return -1;
+	}
+
+	return push(END, mask, verdict);
+}
+
+/* Sets of NFA positions, which are states of DFA,
+ * kept as sorted lists in one pool.
+ */
+static struct
+{
+	unsigned int *pool;
+	unsigned long used;
+	unsigned long size;
+	unsigned long *start;
+	unsigned int *length;
+	unsigned int *seen;
+	unsigned int stamp;
+} sets;
+
+/* Adds position to set, and positions reachable by skipping stars.
+ */
+static void add(unsigned int *set, unsigned int *length, unsigned int p)
+{
+	for (; sets.seen[p] != sets.stamp; p++)
+	{
+		sets.seen[p] = sets.stamp;
+		set[(*length)++] = p;
+
+		if (nfa.element[p] != STAR && nfa.element[p] != DSTAR)
+			break;
+	}
+}
+
+static void sort(unsigned int *set, unsigned int length)
+{
+	for (unsigned int i = 1, j, p; i < length; i++)
+	{
+		for (p = set[i], j = i; j && set[j - 1] > p; j--)
+			set[j] = set[j - 1];
+		set[j] = p;
+	}
+}
+
+/* Makes set of positions, reachable from set by character.
+ */
+static unsigned int step(const unsigned int *set, unsigned int length, unsigned char c, unsigned int *next)
+{
+	unsigned int count = 0;
+
+	sets.stamp++;
+	for (unsigned int i = 0; i < length; i++)
+	{
+		unsigned int p = set[i];
+
+		switch (nfa.element[p])
+		{
+		case ANY:
+			if (c != '/')
+				add(next, &count, p + 1);
+			break;
+		case STAR:
+			if (c != '/')
+				add(next, &count, p);
+			break;
+		case DSTAR:
+			add(next, &count, p);
+			break;
+		case END:
+			break;
+		default:
+			if (nfa.element[p] == c)
+				add(next, &count, p + 1);
+		}
+	}
+
+	sort(next, count);
+	return count;
+}
+
+/* Verdicts of all operations for set of positions, 2 bits each.
+ */
+static unsigned short verdicts(const unsigned int *set, unsigned int length)
+{
+	unsigned short verdict = 0;
+
+	/* positions of later rules are greater */
+	for (unsigned int i = 0; i < length; i++)
+	{
+		unsigned int p = set[i];
+
+		if (nfa.element[p] != END)
+			continue;
+
+		for (int op = 0; op < FU53_OPS; op++)
+		{
+			if (!(nfa.ops[p] & (1 << op)))
+				continue;
+
+			verdict &= ~(3 << (op * 2));
+			verdict |= nfa.verdict[p] << (op * 2);
+		}
+	}
+
+	return verdict;
+}
+
+static unsigned long hash(const unsigned int *set, unsigned int length)
+{
+	unsigned long h = 14695981039346656037ul;
+
+	for (unsigned int i = 0; i < length; i++)
+		h = (h ^ set[i]) * 1099511628211ul;
+
+	return h;
+}
+
+/* Grows state arrays by CHUNK states.
+ */
+static int grow(unsigned int states)
+{
+	void *ptr;
+
+	if (!(ptr = realloc(sets.start, (states + CHUNK) * sizeof(*sets.start))))
+		return -1;
+	sets.start = ptr;
+	if (!(ptr = realloc(sets.length, (states + CHUNK) * sizeof(*sets.length))))
+		return -1;
+	sets.length = ptr;
+	if (!(ptr = realloc(dfa.next, (states + CHUNK) * dfa.classes * sizeof(*dfa.next))))
+		return -1;
+	dfa.next = ptr;
+	if (!(ptr = realloc(dfa.verdict, (states + CHUNK) * sizeof(*dfa.verdict))))
+		return -1;
+	dfa.verdict = ptr;
+
+	return 0;
+}
+
+/* Reserves room for one more set at the end of pool.
+ */
+static unsigned int *reserve(void)
+{
+	void *ptr;
+
+	if (sets.size - sets.used < nfa.count)
+	{
+		sets.size = 2 * sets.size + nfa.count;
+		if (!(ptr = realloc(sets.pool, sets.size * sizeof(*sets.pool))))
+			return NULL;
+		sets.pool = ptr;
+	}
+
+	return sets.pool + sets.used;
+}
+
+/* Returns state of set, which is placed at the end of pool,
+ * and adds new state, when set is new.
+ * Returns -1, when DFA needs too many states.
+ */
+static int state(unsigned int *table, unsigned int *states, unsigned int length)
+{
+	unsigned int *set = sets.pool + sets.used, i;
+
+	for (i = hash(set, length) % HASH; table[i]; i = (i + 1) % HASH)
+	{
+		unsigned int s = table[i] - 1;
+
+		if (sets.length[s] == length && !memcmp(sets.pool + sets.start[s], set, length * sizeof(*set)))
+			return s;
+	}
+
+	if (*states == STATES)
+		return -1;
+	if (*states % CHUNK == 0 && grow(*states) == -1)
+		return -1;
+
+	sets.start[*states] = sets.used;
+	sets.length[*states] = length;
+	sets.used += length;
+	table[i] = ++*states;
+
+	return *states - 1;
+}
+
+/* Builds DFA from NFA with subset construction.
+ * Returns -1, when DFA needs too many states.
+ */
+static int compile(void)
+{
+	unsigned char representative[256];
+	unsigned int *table, *set, states = 0, length;
+	int ret = -1, next;
+
+	/* bytes, which no glob tells apart, share class */
+	dfa.classes = 1;
+	for (unsigned int p = 0; p < nfa.count; p++)
+	{
+		unsigned short c = nfa.element[p];
+
+		if (c < ANY && !dfa.class[c])
+			representative[dfa.classes] = c, dfa.class[c] = dfa.classes++;
+	}
+	if (!dfa.class['/'])
+		representative[dfa.classes] = '/', dfa.class['/'] = dfa.classes++;
+	for (int c = 1; c < 256; c++)
+		if (!dfa.class[c])
+		{
+			representative[0] = c;
+			break;
+		}
+
+	reason = "out of memory";
+	table = calloc(HASH, sizeof(*table));
+	sets.seen = calloc(nfa.count, sizeof(*sets.seen));
+	if (!table || !sets.seen || !reserve())
+		goto out;
+
+	/* state 0 is dead, state 1 is start */
+	state(table, &states, 0);
+	memset(dfa.next, 0, dfa.classes * sizeof(*dfa.next));
+	dfa.verdict[0] = 0;
+
+	set = sets.pool + sets.used;
+	length = 0;
+	sets.stamp++;
+	for (unsigned int p = 0; p < nfa.count; p++)
+		if (!p || nfa.element[p - 1] == END)
+			add(set, &length, p);
+	sort(set, length);
+	state(table, &states, length);
+
+	for (unsigned int s = 1; s < states; s++)
+	{
+		dfa.verdict[s] = verdicts(sets.pool + sets.start[s], sets.length[s]);
+
+		for (unsigned int c = 0; c < dfa.classes; c++)
+		{
+			if (!(set = reserve()))
+				goto out;
+
+			length = step(sets.pool + sets.start[s], sets.length[s], representative[c], set);
+			if ((next = state(table, &states, length)) == -1)
+			{
+				if (states == STATES)
+					reason = "rules need more than 65535 DFA states";
+				goto out;
+			}
+
+			dfa.next[s * dfa.classes + c] = next;
+		}
+	}
+
+	ret = 0;
+out:
+	free(sets.pool);
+	free(sets.start);
+	free(sets.length);
+	free(sets.seen);
+	free(table);
+	return ret;
+}
+
+int fu53_rules_init(const char *path)
+{
+	char line[LINE];
+	unsigned int number = 0;
+	FILE *file;
+	int ret = 0;
+
+	file = ORIGINAL(fopen)(path, "r");
+	if (!file)
+	{
+		fprintf(stderr, "fu53: FU53_RULES=%s can't be read: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	while (ret != -1 && fgets(line, sizeof(line), file))
+	{
+		number++;
+		if (!strchr(line, '\n') && !feof(file))
+		{
+			reason = "line is too long";
+			ret = -1;
+		}
+		else
+			ret = parse_rule(line);
+	}
+	fclose(file);
+
+	if (ret == -1)
+		fprintf(stderr, "fu53: FU53_RULES=%s, line %u: %s\n", path, number, reason);
+	else if (nfa.count && (ret = compile()) == -1)
+		fprintf(stderr, "fu53: FU53_RULES=%s can't be compiled: %s\n", path, reason);
+
+	free(nfa.element);
+	free(nfa.ops);
+	free(nfa.verdict);
+
+	if (ret == -1 || !nfa.count)
+	{
+		free(dfa.next);
+		free(dfa.verdict);
+		return ret;
+	}
+
+	fu53_policy.rules = 1;
+	return 0;
+}
+
+int fu53_rule(enum fu53_op op, const char *pathname)
+{
+	unsigned int state = 1, verdict;
+
+	for (const unsigned char *c = (const unsigned char *)pathname; *c && state; c++)
+		state = dfa.next[state * dfa.classes + dfa.class[*c]];
+
+	verdict = (dfa.verdict[state] >> (op * 2)) & 3;
+	if (verdict == FU53_RULE_DENY)
+		errno = EACCES;
+
+	return verdict;
+}
@@ -0,0 +1,214 @@
+/*
+ * seccomp-bpf backend.
+ * With FU53_SECCOMP=1 library constructor compiles policy into seccomp
+ * filter, so policy holds for raw syscall instructions, static code and
+ * runtimes, which never call libc. Blocked system calls fail with EPERM,
+ * or raise SIGSYS, when NO_* variable of category is set.
+ *
+ * Only calls, which can be decided by number and arguments, are
+ * compiled:
+ * - open(), openat() with write flags, creat(). Read-mode opens pass;
+ * - unlink(), unlinkat(), rmdir();
+ * - execve(), execveat();
+ * - rename(), renameat(), renameat2();
+ * - chown(), lchown(), fchownat(), chmod(), fchmodat();
+ * - chroot();
+ * - fork(), vfork(), clone() without CLONE_THREAD. clone3() fails
+ *   with ENOSYS, because its flags can't be inspected, and libc falls
+ *   back to clone();
+ * - mknod(), mknodat(), pipe(), pipe2(), semget(), semctl();
+ * - unshare(), mount().
+ * Categories with N budgets, opens with WITH_COVERAGE, FU53_SHADOW or
+ * FU53_LANDLOCK, and all path categories (open, remove, rename, change)
+ * with FU53_RULES are left to wrappers and Landlock, because kernel
+ * can't count calls or check paths. dup() family is left to wrappers
+ * too, since libc uses it internally, e.g. in freopen().
+ *
+ * Filter, which can't be installed, e.g. without kernel support,
+ * is reported on stderr, and only wrappers enforce policy.
+ */
+
+#include "fu53.h"
+#include <stddef.h>
+#include <sys/prctl.h>
+#include <linux/audit.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+
+#if defined(__x86_64__)
+#define ARCH AUDIT_ARCH_X86_64
+#elif defined(__aarch64__)
+#define ARCH AUDIT_ARCH_AARCH64
+#endif
+
+#define PROGRAM 256
+
+static struct sock_filter program[PROGRAM];
+static unsigned short length;
+
+static void emit(unsigned short code, unsigned int k, unsigned char jt, unsigned char jf)
+{
+	if (length < PROGRAM)
+		program[length++] = (struct sock_filter)BPF_JUMP(code, k, jt, jf);
+}
+
+#define ARG(n) (offsetof(struct seccomp_data, args[n]))
+
+/* Denies system call.
+ */
+static void deny(long number, unsigned int action)
+{
+	emit(BPF_JMP | BPF_JEQ | BPF_K, number, 0, 1);
+	emit(BPF_RET | BPF_K, action, 0, 0);
+}
+
+/* Denies system call, when its argument has any bit of mask.
+ * With inverted, denies it, when argument has none of them.
+ */
+static void deny_masked(long number, int arg, unsigned int mask, int inverted, unsigned int action)
+{
+	emit(BPF_JMP | BPF_JEQ | BPF_K, number, 0, 4);
+	emit(BPF_LD | BPF_W | BPF_ABS, ARG(arg), 0, 0);
+	emit(BPF_JMP | BPF_JSET | BPF_K, mask, inverted, !inverted);
+	emit(BPF_RET | BPF_K, action, 0, 0);
+	emit(BPF_RET | BPF_K, SECCOMP_RET_ALLOW, 0, 0);
+}
+
+/* Returns filter action for category,
+ * or 0, when category is left to wrappers.
+ */
+static unsigned int action(enum fu53_category category)
+{
+	switch (fu53_policy.action[category])
+	{
+	case FU53_CRASH:
+		return SECCOMP_RET_TRAP;
+	case FU53_BLOCK:
+		return SECCOMP_RET_ERRNO | EPERM;
+	default:
+		return 0;
+	}
+}
+
+static void compile(void)
+{
+	unsigned int act;
+	int paths;
+
+#ifdef ARCH
+	emit(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, arch), 0, 0);
+	emit(BPF_JMP | BPF_JEQ | BPF_K, ARCH, 1, 0);
+	emit(BPF_RET | BPF_K, SECCOMP_RET_ERRNO | EPERM, 0, 0);
+#endif
+	emit(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, nr), 0, 0);
+#ifdef __X32_SYSCALL_BIT
+	emit(BPF_JMP | BPF_JGE | BPF_K, __X32_SYSCALL_BIT, 0, 1);
+	emit(BPF_RET | BPF_K, SECCOMP_RET_ERRNO | EPERM, 0, 0);
+#endif
+
+	/* path rules can allow any call of path categories */
+	paths = !fu53_policy.rules;
+
+	if (paths && (act = action(FU53_OPEN)) && !fu53_policy.coverage && !fu53_policy.shadow && !fu53_policy.landlock)
+	{
+#ifdef __NR_open
+		deny_masked(__NR_open, 1, WRITE_FLAGS | O_TRUNC, 0, act);
+#endif
+#ifdef __NR_creat
+		deny(__NR_creat, act);
+#endif
+		deny_masked(__NR_openat, 2, WRITE_FLAGS | O_TRUNC, 0, act);
+		deny(__NR_openat2, SECCOMP_RET_ERRNO | ENOSYS);
+	}
+
+	if (paths && (act = action(FU53_REMOVE)))
+	{
+#ifdef __NR_unlink
+		deny(__NR_unlink, act);
+		deny(__NR_rmdir, act);
+#endif
+		deny(__NR_unlinkat, act);
+	}
+
+	if ((act = action(FU53_EXEC)))
+	{
+		deny(__NR_execve, act);
+		deny(__NR_execveat, act);
+	}
+
+	if (paths && (act = action(FU53_RENAME)))
+	{
+#ifdef __NR_rename
+		deny(__NR_rename, act);
+#endif
+		deny(__NR_renameat, act);
+		deny(__NR_renameat2, act);
+	}
+
+	if (paths && (act = action(FU53_CHANGE)))
+	{
+#ifdef __NR_chown
+		deny(__NR_chown, act);
+		deny(__NR_lchown, act);
+		deny(__NR_chmod, act);
+#endif
+		deny(__NR_fchownat, act);
+		deny(__NR_fchmodat, act);
+	}
+
+	if ((act = action(FU53_SYSTEM)))
+		deny(__NR_chroot, act);
+
+	if ((act = action(FU53_FORK)))
+	{
+#ifdef __NR_fork
+		deny(__NR_fork, act);
+		deny(__NR_vfork, act);
+#endif
+		deny_masked(__NR_clone, 0, CLONE_THREAD, 1, act);
+		deny(__NR_clone3, SECCOMP_RET_ERRNO | ENOSYS);
+	}
+
+	if ((act = action(FU53_PARALLEL)))
+	{
+#ifdef __NR_mknod
+		deny(__NR_mknod, act);
+		deny(__NR_pipe, act);
+#endif
+		deny(__NR_mknodat, act);
+		deny(__NR_pipe2, act);
+		deny(__NR_semget, act);
+		deny(__NR_semctl, act);
+	}
+
+	if ((act = action(FU53_UNSHARE)))
+		deny(__NR_unshare, act);
+
+	if ((act = action(FU53_MOUNT)))
+		deny(__NR_mount, act);
+
+	emit(BPF_RET | BPF_K, SECCOMP_RET_ALLOW, 0, 0);
+}
+
+int fu53_seccomp_init(void)
+{
+	struct sock_fprog fprog;
+
+	compile();
+	if (length == PROGRAM)
+	{
+		fprintf(stderr, "fu53: FU53_SECCOMP is set, but seccomp filter is too long, it isn't installed\n");
+		return -1;
+	}
+
+	fprog.len = length;
+	fprog.filter = program;
+
+	if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) == -1 || prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &fprog, 0, 0) == -1)
+	{
+		fprintf(stderr, "fu53: FU53_SECCOMP is set, but seccomp filter can't be installed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,348 @@
+/*
+ * Load time selection of wrappers.
+ * Exported functions of table (see FU53_FUNCTIONS) with check other
+ * than CUSTOM, and open(), open64(), openat(), fopen() and fopen64()
+ * jump through pointers. Library constructor points them, when policy
+ * is parsed and rules, Landlock, cache and testcase are set up, to
+ * implementation, chosen once:
+ * - pass calls original function, when category is allowed without
+ *   budget;
+ * - block fails call, when category is blocked;
+ * - sink redirects write-mode opens to /dev/null and passes read-mode
+ *   ones, when OPEN is blocked;
+ * - crash throws assert(0), when NO_* variable is set;
+ * - generic wrapper of fu53.c in all other cases: budgets, path rules,
+ *   Landlock, coverage, shadow, cache and testcase files. Opens are
+ *   always generic with budgets of writes, FU53_WRITE_*.
+ * Specialized implementations have no checks of policy, but count
+ * outcomes and are profiled like generic wrappers.
+ *
+ * Pointers initially hold generic wrappers, so calls, made before
+ * constructor, check policy as usual. With FU53_SELECT=0 generic
+ * wrappers are kept. Exported functions are plain symbols, so dynamic
+ * linker treats them like any other interposed function.
+ */
+
+#include "fu53.h"
+
+#ifdef FU53_SELECT
+
+/* Blocking and crashing implementations don't use parameters.
+ */
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+
+/* Checks of wrappers, which implementations are chosen for.
+ */
+enum check
+{
+	CHECK_ENABLED,
+	CHECK_BUDGET,
+	CHECK_PATH,
+	CHECK_PAIR,
+	CHECK_OPEN
+};
+
+enum variant
+{
+	GENERIC,
+	PASS,
+	BLOCK,
+	SINK,
+	CRASH
+};
+
+/* Chooses implementation of function of category with check.
+ */
+static enum variant choose(enum fu53_category category, enum check check)
+{
+	int paths = (check == CHECK_PATH || check == CHECK_PAIR);
+	int budget = (check == CHECK_BUDGET || check == CHECK_OPEN);
+	unsigned char action = fu53_policy.action[category];
+
+	if (fu53_options.generic)
+		return GENERIC;
+
+	/* opens check NO_* before path rules */
+	if (action == FU53_CRASH)
+		return (fu53_policy.rules && paths ? GENERIC : CRASH);
+
+	if (fu53_policy.rules && (paths || check == CHECK_OPEN))
+		return GENERIC;
+
+	/* permitted opens are counted against budgets of writes */
+	if (fu53_policy.writes && check == CHECK_OPEN)
+		return GENERIC;
+
+	/* testcase, shadow and cached copies are served under any policy */
+	if (check == CHECK_OPEN && (fu53_policy.shadow || fu53_policy.cache || fu53_policy.input))
+		return GENERIC;
+
+	/* applied Landlock allows REMOVE and RENAME itself */
+	if (action == FU53_ALLOW)
+		return (fu53_limits[category] && budget ? GENERIC : PASS);
+
+	if (check == CHECK_OPEN)
+		return (fu53_policy.landlock || fu53_policy.coverage ? GENERIC : SINK);
+
+	return BLOCK;
+}
+
+/* Pointer, which exported function jumps through.
+ */
+#define SELECTED(name) (__atomic_load_n(&selected_##name, __ATOMIC_RELAXED))
+
+/* Implementations of functions with checks other than CUSTOM.
+ */
+#define VARIANTS(name, ret, params, args, category, fail, check)                   \
+	static ret pass_##name params                                                  \
+	{                                                                              \
+		PROFILE(name);                                                             \
+                                                                                   \
+		COUNT(name, ALLOWED);                                                      \
+		return (ORIGINAL(name) args);                                              \
+	}                                                                              \
+                                                                                   \
+	static ret block_##name params                                                 \
+	{                                                                              \
+		PROFILE(name);                                                             \
+                                                                                   \
+		COUNT(name, BLOCKED);                                                      \
+		return fail;                                                               \
+	}                                                                              \
+                                                                                   \
+	static ret crash_##name params                                                 \
+	{                                                                              \
+		COUNT(name, CRASHED);                                                      \
+		assert(0);                                                                 \
+		return fail;                                                               \
+	}                                                                              \
+                                                                                   \
+	static name##_type selected_##name = fu53_generic_##name;                      \
+                                                                                   \
+	static void select_##name(void)                                                \
+	{                                                                              \
+		name##_type function = fu53_generic_##name;                                \
+                                                                                   \
+		switch (choose(category, check))                                           \
+		{                                                                          \
+		case PASS:                                                                 \
+			function = pass_##name;                                                \
+			break;                                                                 \
+		case BLOCK:                                                                \
+			function = block_##name;                                               \
+			break;                                                                 \
+		case CRASH:                                                                \
+			function = crash_##name;                                               \
+			break;                                                                 \
+		default:                                                                   \
+			break;                                                                 \
+		}                                                                          \
+                                                                                   \
+		__atomic_store_n(&selected_##name, function, __ATOMIC_RELAXED);            \
+	}                                                                              \
+                                                                                   \
+	ret name params                                                                \
+	{                                                                              \
+		return (SELECTED(name) args);                                              \
+	}
+
+#define VARIANTS_CUSTOM(...)
+#define VARIANTS_ENABLED(name, ret, params, args, category, fail) \
+	VARIANTS(name, ret, params, args, category, fail, CHECK_ENABLED)
+#define VARIANTS_BUDGET(name, ret, params, args, category, fail) \
+	VARIANTS(name, ret, params, args, category, fail, CHECK_BUDGET)
+#define VARIANTS_PATH(name, ret, params, args, category, fail) \
+	VARIANTS(name, ret, params, args, category, fail, CHECK_PATH)
+#define VARIANTS_PAIR(name, ret, params, args, category, fail) \
+	VARIANTS(name, ret, params, args, category, fail, CHECK_PAIR)
+
+#define X(name, ret, params, args, category, fail, check, paths) \
+	VARIANTS_##check(name, ret, params, args, category, fail)
+FU53_FUNCTIONS(X)
+#undef X
+
+/* Selector of open function with pass, sink and crash implementations.
+ */
+#define SELECTOR(name)                                                  \
+	static name##_type selected_##name = fu53_generic_##name;           \
+                                                                        \
+	static void select_##name(void)                                     \
+	{                                                                   \
+		name##_type function = fu53_generic_##name;                     \
+                                                                        \
+		switch (choose(FU53_OPEN, CHECK_OPEN))                          \
+		{                                                               \
+		case PASS:                                                      \
+			function = pass_##name;                                     \
+			break;                                                      \
+		case SINK:                                                      \
+			function = sink_##name;                                     \
+			break;                                                      \
+		case CRASH:                                                     \
+			function = crash_##name;                                    \
+			break;                                                      \
+		default:                                                        \
+			break;                                                      \
+		}                                                               \
+                                                                        \
+		__atomic_store_n(&selected_##name, function, __ATOMIC_RELAXED); \
+	}
+
+/* Reads mode argument of open(), when flags require it.
+ */
+#define MODE(flags, mode)                   \
+	if (NEEDS_MODE(flags))                  \
+	{                                       \
+		va_list arg;                        \
+		va_start(arg, flags);               \
+		mode = va_arg(arg, mode_t);         \
+		va_end(arg);                        \
+	}
+
+#define OPEN_VARIANTS(name)                                                    \
+	static int pass_##name(const char *pathname, int flags, ...)               \
+	{                                                                          \
+		PROFILE(name);                                                         \
+                                                                               \
+		mode_t mode = 0;                                                       \
+                                                                               \
+		MODE(flags, mode);                                                     \
+		COUNT(name, ALLOWED);                                                  \
+		return (fu53_fd_fresh(ORIGINAL(name)(pathname, flags, mode)));         \
+	}                                                                          \
+                                                                               \
+	static int sink_##name(const char *pathname, int flags, ...)               \
+	{                                                                          \
+		PROFILE(name);                                                         \
+                                                                               \
+		if (flags & WRITE_FLAGS)                                               \
+		{                                                                      \
+			COUNT(name, REDIRECTED);                                           \
+			return (fu53_sink_open(flags));                                    \
+		}                                                                      \
+                                                                               \
+		COUNT(name, ALLOWED);                                                  \
+		return (fu53_fd_fresh(ORIGINAL(name)(pathname, flags)));               \
+	}                                                                          \
+                                                                               \
+	static int crash_##name(const char *pathname, int flags, ...)              \
+	{                                                                          \
+		COUNT(name, CRASHED);                                                  \
+		assert(0);                                                             \
+		return -1;                                                             \
+	}                                                                          \
+                                                                               \
+	SELECTOR(name)                                                             \
+                                                                               \
+	int name(const char *pathname, int flags, ...)                             \
+	{                                                                          \
+		mode_t mode = 0;                                                       \
+                                                                               \
+		MODE(flags, mode);                                                     \
+		return (SELECTED(name)(pathname, flags, mode));                        \
+	}
+
+OPEN_VARIANTS(open)
+OPEN_VARIANTS(open64)
+
+static int pass_openat(int dirfd, const char *pathname, int flags, ...)
+{
+	PROFILE(openat);
+
+	mode_t mode = 0;
+
+	MODE(flags, mode);
+	COUNT(openat, ALLOWED);
+	return (fu53_fd_fresh(ORIGINAL(openat)(dirfd, pathname, flags, mode)));
+}
+
+static int sink_openat(int dirfd, const char *pathname, int flags, ...)
+{
+	PROFILE(openat);
+
+	if (flags & WRITE_FLAGS)
+	{
+		COUNT(openat, REDIRECTED);
+		return (fu53_sink_open(flags));
+	}
+
+	COUNT(openat, ALLOWED);
+	return (fu53_fd_fresh(ORIGINAL(openat)(dirfd, pathname, flags)));
+}
+
+static int crash_openat(int dirfd, const char *pathname, int flags, ...)
+{
+	COUNT(openat, CRASHED);
+	assert(0);
+	return -1;
+}
+
+SELECTOR(openat)
+
+int openat(int dirfd, const char *pathname, int flags, ...)
+{
+	mode_t mode = 0;
+
+	MODE(flags, mode);
+	return (SELECTED(openat)(dirfd, pathname, flags, mode));
+}
+
+#define FOPEN_VARIANTS(name)                                                   \
+	static FILE *pass_##name(const char *pathname, const char *mode)           \
+	{                                                                          \
+		PROFILE(name);                                                         \
+                                                                               \
+		COUNT(name, ALLOWED);                                                  \
+		return (ORIGINAL(name)(pathname, mode));                               \
+	}                                                                          \
+                                                                               \
+	static FILE *sink_##name(const char *pathname, const char *mode)           \
+	{                                                                          \
+		PROFILE(name);                                                         \
+                                                                               \
+		if (write_mode(mode))                                                  \
+		{                                                                      \
+			COUNT(name, REDIRECTED);                                           \
+			return (fu53_sink_stream(mode));                                   \
+		}                                                                      \
+                                                                               \
+		COUNT(name, ALLOWED);                                                  \
+		return (ORIGINAL(name)(pathname, mode));                               \
+	}                                                                          \
+                                                                               \
+	static FILE *crash_##name(const char *pathname, const char *mode)          \
+	{                                                                          \
+		COUNT(name, CRASHED);                                                  \
+		assert(0);                                                             \
+		return NULL;                                                           \
+	}                                                                          \
+                                                                               \
+	SELECTOR(name)                                                             \
+                                                                               \
+	FILE *name(const char *pathname, const char *mode)                         \
+	{                                                                          \
+		return (SELECTED(name)(pathname, mode));                               \
+	}
+
+FOPEN_VARIANTS(fopen)
+FOPEN_VARIANTS(fopen64)
+
+void fu53_select(void)
+{
+#define SELECT_CUSTOM(name)
+#define SELECT_ENABLED(name) select_##name();
+#define SELECT_BUDGET(name) select_##name();
+#define SELECT_PATH(name) select_##name();
+#define SELECT_PAIR(name) select_##name();
+#define X(name, ret, params, args, category, fail, check, paths) SELECT_##check(name)
+	FU53_FUNCTIONS(X)
+#undef X
+
+	select_open();
+	select_open64();
+	select_openat();
+	select_fopen();
+	select_fopen64();
+}
+
+#endif
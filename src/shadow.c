@@ -0,0 +1,190 @@
+/*
+ * Shadow files.
+ * With FU53_SHADOW=1 write-mode opens, which would be redirected to
+ * /dev/null, get memfd copy of file instead. Copy is made on first
+ * write-mode open of path, and seeded from real file, when it exists.
+ * Later opens of the same path, read-mode ones too, see the copy, so
+ * targets, which write file and read it back, keep working. Shadows
+ * live in RAM only and are dropped on reset of execution context,
+ * which walks live shadows only.
+ * Shadows are keyed by canonical paths (see canon.c), so "a", "./a"
+ * and openat(dirfd, "a") of the same directory share one copy.
+ *
+ * Every open gets its own file description by reopening memfd through
+ * /proc/self/fd, so file offsets aren't shared between opens.
+ */
+
+#include "fu53.h"
+
+#define SHADOWS 256
+
+static struct
+{
+	struct fu53_key key;
+	int fd;
+} shadows[SHADOWS];
+
+/* Slots of live shadows, so reset walks only them.
+ */
+static unsigned short live[SHADOWS];
+static unsigned int count;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Copies content of real file into memfd.
+ */
+static void seed(int fd, int dirfd, const char *pathname)
+{
+	int real = ORIGINAL(openat)(dirfd, pathname, O_RDONLY | O_CLOEXEC);
+	ssize_t ret;
+
+	if (real == -1)
+		return;
+
+	do
+		ret = ORIGINAL(sendfile)(fd, real, NULL, 1 << 20);
+	while (ret > 0);
+
+	ORIGINAL(close)(real);
+}
+
+/* Opens new file description of shadow.
+ */
+static int reopen(int fd, int flags)
+{
+	char path[32];
+
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+	flags &= O_ACCMODE | O_APPEND | O_CLOEXEC | O_NONBLOCK | O_SYNC | O_DSYNC;
+
+	return (ORIGINAL(openat)(AT_FDCWD, path, flags));
+}
+
+int fu53_shadow_open(int dirfd, const char *pathname, int flags)
+{
+	char buf[PATH_MAX];
+	const char *canonical = fu53_canon(dirfd, pathname, buf);
+	unsigned long h;
+	struct stat st;
+	int i, fd, ret;
+
+	if (!canonical)
+		return FU53_SHADOW_NONE;
+
+	h = fu53_hash(canonical);
+
+	pthread_mutex_lock(&lock);
+	i = fu53_slot(shadows, sizeof(*shadows), SHADOWS, canonical, h);
+	if (i == -1)
+	{
+		pthread_mutex_unlock(&lock);
+		return FU53_SHADOW_NONE;
+	}
+
+	if (shadows[i].key.path)
+	{
+		if ((flags & (O_CREAT | O_EXCL)) == (O_CREAT | O_EXCL))
+		{
+			pthread_mutex_unlock(&lock);
+			errno = EEXIST;
+			return -1;
+		}
+
+		if (flags & O_TRUNC)
+			ftruncate(shadows[i].fd, 0);
+
+		ret = reopen(shadows[i].fd, flags);
+		pthread_mutex_unlock(&lock);
+		return ret;
+	}
+
+	/* new shadow follows semantics of real file */
+	if (fstatat(dirfd, pathname, &st, 0) == -1)
+	{
+		if (!(flags & O_CREAT))
+		{
+			pthread_mutex_unlock(&lock);
+			errno = ENOENT;
+			return -1;
+		}
+	}
+	else if ((flags & (O_CREAT | O_EXCL)) == (O_CREAT | O_EXCL))
+	{
+		pthread_mutex_unlock(&lock);
+		errno = EEXIST;
+		return -1;
+	}
+	else if (!S_ISREG(st.st_mode))
+	{
+		pthread_mutex_unlock(&lock);
+		return FU53_SHADOW_NONE;
+	}
+
+	fd = memfd_create("fu53", MFD_CLOEXEC);
+	shadows[i].key.path = (fd == -1 ? NULL : strdup(canonical));
+	if (!shadows[i].key.path)
+	{
+		if (fd != -1)
+			ORIGINAL(close)(fd);
+		pthread_mutex_unlock(&lock);
+		return FU53_SHADOW_NONE;
+	}
+
+	if (!(flags & O_TRUNC))
+		seed(fd, dirfd, pathname);
+
+	shadows[i].key.hash = h;
+	shadows[i].fd = fd;
+	live[count] = i;
+	__atomic_add_fetch(&count, 1, __ATOMIC_RELEASE);
+
+	ret = reopen(fd, flags);
+	pthread_mutex_unlock(&lock);
+	return ret;
+}
+
+int fu53_shadow_find(int dirfd, const char *pathname, int flags)
+{
+	char buf[PATH_MAX];
+	const char *canonical;
+	unsigned long h;
+	int i, ret = FU53_SHADOW_NONE;
+
+	if (!__atomic_load_n(&count, __ATOMIC_ACQUIRE))
+		return FU53_SHADOW_NONE;
+
+	canonical = fu53_canon(dirfd, pathname, buf);
+	if (!canonical)
+		return FU53_SHADOW_NONE;
+
+	h = fu53_hash(canonical);
+	pthread_mutex_lock(&lock);
+	i = fu53_slot(shadows, sizeof(*shadows), SHADOWS, canonical, h);
+	if (i != -1 && shadows[i].key.path)
+		ret = reopen(shadows[i].fd, flags);
+	pthread_mutex_unlock(&lock);
+
+	return ret;
+}
+
+void fu53_shadow_reset(int child)
+{
+	int i;
+
+	/* lock could be held by other thread at fork */
+	if (child)
+		pthread_mutex_init(&lock, NULL);
+
+	if (!__atomic_load_n(&count, __ATOMIC_ACQUIRE))
+		return;
+
+	pthread_mutex_lock(&lock);
+	for (unsigned int n = 0; n < count; n++)
+	{
+		i = live[n];
+		ORIGINAL(close)(shadows[i].fd);
+		free(shadows[i].key.path);
+		shadows[i].key.path = NULL;
+	}
+	__atomic_store_n(&count, 0, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,202 @@
+/*
+ * Sink descriptors.
+ * /dev/null is opened once for every access mode by constructor, before
+ * seccomp filter denies write-mode opens, and every redirected
+ * write-mode open gets its duplicate, which costs neither path lookup
+ * nor new open file description. Sink is checked with fstat() before
+ * duplicate and is reopened, when target closed it behind library.
+ * When it can't be reopened, e.g. under seccomp filter, other live sink
+ * is used, with access mode other than caller asked.
+ * Sink descriptors, held by target, are tracked in map of descriptors
+ * (see fds.c), so their number is bounded by FU53_SINK_MAX (512 by
+ * default) and reported by fu53_sink_count().
+ *
+ * Map must not keep numbers, which are closed behind library, because
+ * writes to new file with such number would be discarded. So
+ * close_range(), closefrom() and close by syscall() are interposed,
+ * opens and dup*() reset class of descriptors, which they return,
+ * and dup*() checks identity of sink with fstat().
+ */
+
+#include "fu53.h"
+
+/* Sinks are moved to high descriptors,
+ * so descriptors of target are numbered as without library.
+ */
+#define SINK_FD 1000
+#define SINK_MAX 512
+
+/* Sinks of write-only and read-write opens, with and without O_APPEND,
+ * so F_GETFL of duplicate shows access mode of caller.
+ */
+#define SINKS 4
+
+static int sinks[SINKS] = {-1, -1, -1, -1};
+static dev_t null_rdev;
+static unsigned int limit = SINK_MAX;
+static unsigned int held;
+static unsigned int peak;
+
+/* Returns sink of open() flags.
+ */
+static int variant(int flags)
+{
+	return ((flags & O_ACCMODE) == O_RDWR) | ((flags & O_APPEND) ? 2 : 0);
+}
+
+int fu53_sink_is(int fd)
+{
+	struct stat st;
+
+	return (null_rdev && !fstat(fd, &st) && S_ISCHR(st.st_mode) && st.st_rdev == null_rdev);
+}
+
+/* Opens sink, when it's missing, or its descriptor was closed behind
+ * library, e.g. by close_range() or raw system call, and its number
+ * can belong to other file now.
+ */
+static int open_sink(int i)
+{
+	static const int modes[SINKS] = {O_WRONLY, O_RDWR, O_WRONLY | O_APPEND, O_RDWR | O_APPEND};
+	int sink = __atomic_load_n(&sinks[i], __ATOMIC_ACQUIRE), fd, high;
+	struct stat st;
+
+	if (sink != -1 && fu53_sink_is(sink))
+		return sink;
+
+	fd = ORIGINAL(openat)(AT_FDCWD, "/dev/null", modes[i] | O_CLOEXEC);
+	if (fd == -1)
+	{
+		for (int j = 0; j < SINKS; j++)
+		{
+			sink = __atomic_load_n(&sinks[j], __ATOMIC_ACQUIRE);
+			if (j != i && sink != -1 && fu53_sink_is(sink))
+				return sink;
+		}
+
+		return -1;
+	}
+
+	if (!null_rdev && !fstat(fd, &st))
+		null_rdev = st.st_rdev;
+
+	high = fcntl(fd, F_DUPFD_CLOEXEC, SINK_FD);
+	if (high != -1)
+	{
+		ORIGINAL(close)(fd);
+		fd = high;
+	}
+
+	/* stale number isn't closed, it's not ours anymore */
+	if (!__atomic_compare_exchange_n(&sinks[i], &sink, fd, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+	{
+		ORIGINAL(close)(fd);
+		return sink;
+	}
+
+	return fd;
+}
+
+void fu53_sink_init(void)
+{
+	if (fu53_options.sink_max)
+		limit = fu53_options.sink_max;
+
+	for (int i = 0; i < SINKS; i++)
+		open_sink(i);
+}
+
+void fu53_sink_hold(void)
+{
+	unsigned int now = __atomic_add_fetch(&held, 1, __ATOMIC_RELAXED);
+
+	if (now > __atomic_load_n(&peak, __ATOMIC_RELAXED))
+		__atomic_store_n(&peak, now, __ATOMIC_RELAXED);
+}
+
+void fu53_sink_release(void)
+{
+	__atomic_sub_fetch(&held, 1, __ATOMIC_RELAXED);
+}
+
+static void track(int fd)
+{
+	if (fd < 0 || fd >= FU53_FDS)
+		return;
+
+	fu53_fd_set(fd, FU53_FD_SINK);
+	fu53_sink_hold();
+}
+int fu53_sink_open(int flags)
+{
+	int sink, fd;
+
+	if (__atomic_load_n(&held, __ATOMIC_RELAXED) >= limit)
+	{
+		errno = EMFILE;
+		return -1;
+	}
+
+	sink = open_sink(variant(flags));
+	if (sink == -1)
+		return (ORIGINAL(openat)(AT_FDCWD, "/dev/null", flags));
+
+	fd = fcntl(sink, (flags & O_CLOEXEC) ? F_DUPFD_CLOEXEC : F_DUPFD, 0);
+	track(fd);
+
+	return fd;
+}
+
+FILE *fu53_sink_stream(const char *mode)
+{
+	FILE *stream = fu53_null_stream();
+	int flags = (strchr(mode, '+') ? O_RDWR : O_WRONLY) | (*mode == 'a' ? O_APPEND : 0);
+	int sink, fd;
+
+	if (stream)
+		return stream;
+
+	sink = open_sink(variant(flags));
+	if (sink == -1)
+		fd = ORIGINAL(openat)(AT_FDCWD, "/dev/null", flags);
+	else
+		fd = fcntl(sink, F_DUPFD, 0);
+
+	if (fd == -1)
+		return NULL;
+
+	stream = ORIGINAL(fdopen)(fd, mode);
+	if (!stream)
+		ORIGINAL(close)(fd);
+	return stream;
+}
+
+void fu53_sink_close(int fd)
+{
+	fu53_sink_close_range(fd, fd);
+}
+
+void fu53_sink_close_range(unsigned int first, unsigned int last)
+{
+	int sink;
+
+	for (int i = 0; i < SINKS; i++)
+	{
+		sink = __atomic_load_n(&sinks[i], __ATOMIC_RELAXED);
+		if (sink != -1 && (unsigned int)sink >= first && (unsigned int)sink <= last)
+			__atomic_store_n(&sinks[i], -1, __ATOMIC_RELAXED);
+	}
+}
+
+void fu53_sink_reset(void)
+{
+	__atomic_store_n(&peak, __atomic_load_n(&held, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+}
+
+unsigned int fu53_sink_count(unsigned int *max)
+{
+	if (max)
+		*max = __atomic_load_n(&peak, __ATOMIC_RELAXED);
+
+	return __atomic_load_n(&held, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,70 @@
+/*
+ * Statistics.
+ * Every wrapper counts outcomes of its calls: passed to original
+ * function, redirected, blocked, crashed and ones, which ran out of
+ * WITH_* budget. Counters of every function have their own cache line
+ * and are incremented with relaxed atomics, so counting costs one
+ * increment and threads of target don't share lines for different
+ * functions.
+ *
+ * With FU53_STATS=<name> counters are mapped at /dev/shm/<name>, so
+ * fuzzer or monitor can read them, while target runs. Block is made by
+ * library constructor and is shared by forked children, so counters of
+ * forkserver cover the whole campaign. See struct fu53_stats for layout.
+ */
+
+#include "fu53.h"
+
+static struct fu53_stats block;
+
+struct fu53_stats *fu53_stats = &block;
+
+static const char *const names[FU53_FUNCTIONS_COUNT] = {
+#define X(name, ...) [FU53_FN_##name] = #name,
+	FU53_FUNCTIONS(X)
+#undef X
+};
+
+static void header(struct fu53_stats *stats)
+{
+	memcpy(stats->magic, FU53_STATS_MAGIC, sizeof(stats->magic));
+	stats->version = FU53_STATS_VERSION;
+	stats->functions = FU53_FUNCTIONS_COUNT;
+	stats->outcomes = FU53_OUTCOMES;
+	stats->pid = getpid();
+
+	for (int i = 0; i < FU53_FUNCTIONS_COUNT; i++)
+		strncpy(stats->name[i], names[i], FU53_NAME_LEN - 1);
+}
+
+int fu53_stats_init(const char *name)
+{
+	char path[PATH_MAX];
+	struct fu53_stats *stats;
+	int fd;
+
+	header(&block);
+
+	if (snprintf(path, sizeof(path), "/dev/shm/%s", name) >= (int)sizeof(path))
+		return -1;
+
+	fd = ORIGINAL(openat)(AT_FDCWD, path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (fd == -1)
+		return -1;
+
+	if (ftruncate(fd, sizeof(*stats)) == -1)
+	{
+		ORIGINAL(close)(fd);
+		return -1;
+	}
+
+	stats = ORIGINAL(mmap)(NULL, sizeof(*stats), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	ORIGINAL(close)(fd);
+	if (stats == MAP_FAILED)
+		return -1;
+
+	/* calls, made before constructor, are kept */
+	memcpy(stats, &block, sizeof(*stats));
+	__atomic_store_n(&fu53_stats, stats, __ATOMIC_RELEASE);
+	return 0;
+}
@@ -0,0 +1,55 @@
+/*
+ * Table of original functions.
+ * All originals are resolved with dlsym(RTLD_NEXT) in one pass by
+ * library constructor, so first call of every wrapper doesn't pay for
+ * dynamic linker lookup. Wrappers, called before constructor, resolve
+ * the whole table by themselves. Wrappers, called while table is being
+ * resolved (dlsym can allocate and open files), get fallbacks.
+ * Library, linked with ld --wrap, has no table.
+ */
+
+#include "fu53.h"
+
+#ifndef FU53_WRAP
+
+void *fu53_originals[FU53_FUNCTIONS_COUNT];
+
+static const char *const names[FU53_FUNCTIONS_COUNT] = {
+#define X(name, ...) [FU53_FN_##name] = #name,
+	FU53_FUNCTIONS(X)
+#undef X
+};
+
+/* 0 - not resolved, 1 - in progress, 2 - resolved.
+ */
+static char state;
+
+static void resolve_all(void)
+{
+	void *function;
+
+	for (int i = 0; i < FU53_FUNCTIONS_COUNT; i++)
+	{
+		function = dlsym(RTLD_NEXT, names[i]);
+		__atomic_store_n(&fu53_originals[i], function ? function : fu53_fallbacks[i], __ATOMIC_RELEASE);
+	}
+}
+
+void *fu53_resolve(enum fu53_function id)
+{
+	char expected = 0;
+
+	if (__atomic_compare_exchange_n(&state, &expected, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+	{
+		fu53_init();
+		resolve_all();
+		__atomic_store_n(&state, 2, __ATOMIC_RELEASE);
+	}
+
+	if (__atomic_load_n(&state, __ATOMIC_ACQUIRE) != 2)
+		return fu53_fallbacks[id];
+
+	return fu53_originals[id];
+}
+
+#endif
@@ -0,0 +1,82 @@
+/*
+ * Budgets of permitted writes.
+ * WITH_OPEN=N limits number of original opens, but one of them can
+ * still fill disk. FU53_WRITE_FILES=N limits number of permitted
+ * write-mode opens, and FU53_WRITE_BYTES=N[kMG] limits bytes, written
+ * to descriptors of such opens by write(), writev(), pwrite(),
+ * sendfile() and copy_file_range(), during one execution. Writes to
+ * sink, shadow and coverage files aren't counted.
+ *
+ * Over budget FU53_WRITE_ACTION is taken: "enospc" (default) fails
+ * call with ENOSPC, "sink" redirects open to /dev/null and discards
+ * write, "crash" throws assert(0) like NO_* variables. File is taken
+ * before original open is called, so open over budget doesn't create
+ * or truncate real file, and it's given back, when open fails.
+ *
+ * Budgets are shared by all threads and are refilled on every reset
+ * of execution context. Writes of stdio streams are made inside libc,
+ * so streams are counted by files only.
+ */
+
+#include "fu53.h"
+
+static struct
+{
+	long bytes;
+	long files;
+} __attribute__((aligned(64))) left;
+
+void fu53_writes_reset(void)
+{
+	__atomic_store_n(&left.bytes, fu53_options.write_bytes, __ATOMIC_RELAXED);
+	__atomic_store_n(&left.files, fu53_options.write_files, __ATOMIC_RELAXED);
+}
+
+size_t fu53_write_take(size_t count)
+{
+	long bytes = __atomic_load_n(&left.bytes, __ATOMIC_RELAXED), take;
+
+	if (!fu53_options.write_bytes)
+		return count;
+
+	do
+	{
+		if (bytes <= 0)
+			return 0;
+
+		take = (count < (size_t)bytes ? (long)count : bytes);
+	} while (!__atomic_compare_exchange_n(&left.bytes, &bytes, bytes - take, 1,
+										  __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+	return take;
+}
+
+void fu53_write_give(size_t count)
+{
+	if (fu53_options.write_bytes && count)
+		__atomic_add_fetch(&left.bytes, count, __ATOMIC_RELAXED);
+}
+
+int fu53_write_file(void)
+{
+	long files = __atomic_load_n(&left.files, __ATOMIC_RELAXED);
+
+	if (!fu53_options.write_files)
+		return 1;
+
+	/* refunds of failed opens must not be eaten by calls over budget */
+	do
+	{
+		if (files <= 0)
+			return 0;
+	} while (!__atomic_compare_exchange_n(&left.files, &files, files - 1, 1,
+										  __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+	return 1;
+}
+
+void fu53_write_file_give(void)
+{
+	if (fu53_options.write_files)
+		__atomic_add_fetch(&left.files, 1, __ATOMIC_RELAXED);
+}